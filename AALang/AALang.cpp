@@ -1,1012 +1,2027 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <stack>
 #include <map>
 #include <functional>
 #include <filesystem>
-#include <fstream>
 #include <cstdio>
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
 #include <array>
 #include <sstream>
 #include <math.h>
+#include <cmath>
 
-#include "Variable.h"
-#include "Token.h"
-#include "CallStack.h"
-#include "Function.h"
-
-#include <regex>
+#include "AALang.h"
+#include "ScriptCache.h"
 
 #include <chrono>
 
-typedef std::vector<std::string> Program;
-
-struct AALang;
-
-void loadProgram(std::filesystem::path filepath, Program* p, AALang* aaLang);
-
 bool isIdentifierChar(char v)
 {
 	return ((v >= 'A' && v <= 'Z') || (v >= 'a' && v <= 'z') || v == '_');
 }
+bool isDigitChar(char v)
+{
+	return v >= '0' && v <= '9';
+}
 bool isNumericChar(char v)
 {
-	return ((v >= '0' && v <= '9') || v == '.' || v == '-');
+	return isDigitChar(v) || v == '.';
+}
+
+// tokens a following '-' is subtracted from rather than a sign of
+static bool isOperand(const Token& token)
+{
+	return token.type == Token::TokenType::T_Identifier || token.type == Token::TokenType::T_Number || token.type == Token::TokenType::T_String
+		|| token.type == Token::TokenType::T_CloseParenthesis || token.type == Token::TokenType::T_CloseSquareBracket;
+}
+
+// why the event loop stopped, to add to an error message
+static std::string loopFailure(const EventLoop& eventLoop)
+{
+	return eventLoop.failure.empty() ? std::string() : " (" + eventLoop.failure + ")";
+}
+
+// null takes part in arithmetic as the integer 0
+static inline bool integral(const Variable& v)
+{
+	return v.type == Variable::VariableType::P_Int || v.type == Variable::VariableType::P_NULL;
+}
+
+static inline int64_t intValue(const Variable& v)
+{
+	return v.type == Variable::VariableType::P_Int ? v.iValue : 0;
+}
+
+// both operands are integers, the arithmetic builtins skip the conversion to double
+static inline bool integers(const Variable& v1, const Variable& v2)
+{
+	return integral(v1) && integral(v2);
+}
+
+// the builtins the compiler turns into opcodes, shared with their Function
+static inline Variable equalsValues(const Variable& v1, const Variable& v2)
+{
+	if (integers(v1, v2))
+		return Variable((int64_t)(intValue(v1) == intValue(v2)));
+	return Variable((int64_t)(v1.number() == v2.number()));
+}
+
+static inline Variable ltValues(const Variable& v1, const Variable& v2)
+{
+	if (integers(v1, v2))
+		return Variable((int64_t)(intValue(v1) < intValue(v2)));
+	return Variable((int64_t)(v1.number() < v2.number()));
+}
+
+static inline Variable addValues(const Variable& v1, const Variable& v2)
+{
+	if (v1.type == Variable::VariableType::P_String && v2.type == Variable::VariableType::P_String)
+		return Variable::concat(v1, v2);
+	if (integers(v1, v2))
+		return Variable((int64_t)((uint64_t)intValue(v1) + (uint64_t)intValue(v2)));
+	return Variable(v1.number() + v2.number());
+}
+
+static inline Variable mulValues(const Variable& v1, const Variable& v2)
+{
+	if (integers(v1, v2))
+		return Variable((int64_t)((uint64_t)intValue(v1) * (uint64_t)intValue(v2)));
+	return Variable(v1.number() * v2.number());
+}
+
+static inline Variable minValues(const Variable& v1, const Variable& v2)
+{
+	return ltValues(v2, v1).iValue ? v2 : v1;
+}
+
+static inline Variable maxValues(const Variable& v1, const Variable& v2)
+{
+	return ltValues(v1, v2).iValue ? v2 : v1;
+}
+
+static inline Variable subValues(const Variable& v1, const Variable& v2)
+{
+	if (integers(v1, v2))
+		return Variable((int64_t)((uint64_t)intValue(v1) - (uint64_t)intValue(v2)));
+	return Variable(v1.number() - v2.number());
 }
 
-struct AALang
+// statements whose tokens or chunks are kept, an interpreter fed an endless
+// stream of distinct lines would otherwise keep all of them
+static const size_t statementCacheCapacity = 65536;
+// block ids are collected once this many are handed out, then whenever
+// twice as many as the last collection left are
+static const size_t minimumBlockCollection = 4096;
+
+// counts the statements and blocks running on an interpreter for as long
+// as it is in scope
+struct Running
 {
-	AALang()
+	Running(size_t& count)
+		:count(count)
+	{
+		count++;
+	}
+	~Running()
 	{
-		null = std::make_shared<Variable>(); //default null
-		isInForeach = false;
-		value = nullptr;
-		registerSTDLib();
-		startTime = std::chrono::high_resolution_clock::now();
+		count--;
 	}
 
-	void registerSTDLib()
+	size_t& count;
+};
+
+// the frame of a block for as long as it is in scope, none for nullptr
+struct FrameScope
+{
+	FrameScope(AALang* aaLang, const std::vector<int>* names)
+		:aaLang(names ? aaLang : nullptr)
+	{
+		if (names)
+			aaLang->pushFrame(*names);
+	}
+	~FrameScope()
 	{
-		registerFunction(
-			new Function("timeMS", 0, [this](CallStack* p) {
-				return std::make_shared<Variable>((std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()));
+		if (aaLang)
+			aaLang->popFrame();
+	}
+
+	AALang* aaLang;
+};
+
+// include() runs its statements at the top level, in a frame without locals
+static const std::vector<int> topLevel;
+
+AALang::AALang()
+	:tokenCache(statementCacheCapacity), compiler(this), lineCache(statementCacheCapacity)
+{
+	HeapScope scope(&heap);
+	treeWalk = false;
+	inlineBlocks = false;
+	useScriptCache = true;
+	parallelThreads = 0;
+	errors = 0;
+	running = 0;
+	nextBlockCollection = minimumBlockCollection;
+	operandStack.reserve(256);
+	registerSTDLib();
+	startTime = std::chrono::high_resolution_clock::now();
+}
+
+AALang::~AALang()
+{
+	// the workers hold no Variables of ours, stop them first
+	pool.reset();
+	writeProfile();
+
+	HeapScope scope(&heap);
+	output.flush();
+
+	lineCache.clear();
+	tokenCache.clear();
+	for (Function* function : natives)
+		delete function;
+}
+
+// path.txt gets the report, path.folded the stacks for flamegraph.pl
+void AALang::startProfiling(const std::string& path)
+{
+	profiler = std::make_unique<Profiler>(&heap);
+	profilePath = path;
+}
+
+void AALang::writeProfile()
+{
+	if (!profiler)
+		return;
+
+	std::ofstream report(profilePath + ".txt");
+	profiler->report(report);
+	std::ofstream folded(profilePath + ".folded");
+	profiler->writeFolded(folded);
+	std::cout << "Profile written to " << profilePath << ".txt and " << profilePath << ".folded" << std::endl;
+	profiler.reset();
+}
+
+// errors go straight to std::cout, anything print() buffered comes first
+std::ostream& AALang::error()
+{
+	output.flush();
+	errors++;
+	return output.errorStream();
+}
+
+void AALang::setArguments(const std::vector<std::string>& arguments)
+{
+	HeapScope scope(&heap);
+	Variable map = Variable::map();
+	for (size_t i = 0; i < arguments.size(); i++)
+		map.mapValues()[Variable((int64_t)i)] = Variable(arguments[i]);
+	assignVariable("args", map);
+	assignVariable("argc", Variable((int64_t)arguments.size()));
+}
+
+void AALang::registerSTDLib()
+{
+	registerFunction(
+		new Function("timeMS", 0, [](AALang* aaLang, Arguments&) {
+			return Variable((std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - aaLang->startTime).count()));
+		}
+	));
+
+	registerFunction(
+		new Function("while", 2, [](AALang* aaLang, Arguments& args) {
+			Variable eval = args[0];
+
+			if (eval.type != Variable::VariableType::P_Block)
+			{
+				aaLang->error() << "Runtime Error: 1st parameter of while() must be a block!" << std::endl;
+				return aaLang->null;
 			}
-		));
 
-		registerFunction(
-			new Function("while", 2, [this](CallStack* p) {
-				std::shared_ptr<Variable> eval = p->top();
-				p->pop();
+			Variable block = args[1];
+			args.release();
 
-				if (eval->type != Variable::VariableType::P_Block)
-				{
-					std::cout << "Runtime Error: 1st parameter of while() must be a block!" << std::endl;
-					return null;
-				}
+			if (block.type != Variable::VariableType::P_Block)
+			{
+				aaLang->error() << "Runtime Error: 2nd parameter of while() must be a block!" << std::endl;
+				return aaLang->null;
+			}
 
-				std::shared_ptr<Variable> block = p->top();
-				p->pop();
+			while (aaLang->executeBlock(&eval).integer() != 0)
+			{
+				aaLang->executeBlock(&block);
+			}
+			return aaLang->null;
+		}
+	));
 
-				if (eval->type != Variable::VariableType::P_Block)
-				{
-					std::cout << "Runtime Error: 2nd parameter of while() must be a block!" << std::endl;
-					return null;
-				}
+	registerFunction(
+		new Function("foreach", 4, [](AALang* aaLang, Arguments& args) {
+		Variable v = args[0];
+
+		// key and val are written through, keep the references as they were passed
+		Variable key = args.raw(1);
+		Variable val = args.raw(2);
+
+		Variable block = args[3];
+		args.release();
+
+		if (block.type != Variable::VariableType::P_Block)
+		{
+			aaLang->error() << "Runtime Error: 2nd parameter of foreach() must be a block!" << std::endl;
+			return aaLang->null;
+		}
+
+		if (!aaLang->beginIteration(v, key, val))
+			return aaLang->null;
+
+		while (aaLang->nextIteration())
+			aaLang->executeBlock(&block);
+
+		return aaLang->null;
+	}
+	));
+	registerFunction(
+		new Function("value", 0, [](AALang* aaLang, Arguments&) {
+			if (aaLang->iterations.empty())
+			{
+				aaLang->error() << "Runtime Error: value() cannot be called outside of foreach()" << std::endl;
+				return aaLang->null;
+			}
+
+			AALang::Iteration& iteration = aaLang->iterations.back();
+			if (iteration.map.type != Variable::VariableType::P_Map)
+				return Variable(iteration.index);
+
+			// the element itself, value() = x writes into the map
+			return Variable::reference(&iteration.position.value());
+		}
+	));
+	registerFunction(
+		new Function("key", 0, [](AALang* aaLang, Arguments&) {
+			if (aaLang->iterations.empty())
+			{
+				aaLang->error() << "Runtime Error: key() cannot be called outside of foreach()" << std::endl;
+				return aaLang->null;
+			}
+
+			AALang::Iteration& iteration = aaLang->iterations.back();
+			if (iteration.map.type != Variable::VariableType::P_Map)
+				return Variable(iteration.index);
+			return iteration.position.key();
+		}
+	));
+	registerFunction(
+		new Function("parallelFor", 3, [](AALang* aaLang, Arguments& args) {
+			int64_t start = args[0].integer();
+			Variable end = Variable(args[1].integer());
+			Variable block = args[2];
+			// the block results are added up unless a 4th parameter names
+			// another reduction: "add", "mul", "min" or "max"
+			std::string reduction = args.count > 3 ? std::string(args[3].string()) : "add";
+			args.release();
+
+			if (block.type != Variable::VariableType::P_Block && block.type != Variable::VariableType::P_String)
+			{
+				aaLang->error() << "Runtime Error: 3rd parameter of parallelFor() must be a block!" << std::endl;
+				return aaLang->null;
+			}
+
+			Variable(*combine)(const Variable&, const Variable&) = nullptr;
+			if (reduction == "add")
+				combine = addValues;
+			else if (reduction == "mul")
+				combine = mulValues;
+			else if (reduction == "min")
+				combine = minValues;
+			else if (reduction == "max")
+				combine = maxValues;
+			else
+			{
+				aaLang->error() << "Runtime Error: 4th parameter of parallelFor() must be \"add\", \"mul\", \"min\" or \"max\"!" << std::endl;
+				return aaLang->null;
+			}
+
+			return runParallel(aaLang, end, start, block, combine);
+		}
+	));
+	registerFunction(
+		new Function("parallelMap", 2, [](AALang* aaLang, Arguments& args) {
+			Variable collection = args[0];
+			Variable block = args[1];
+			args.release();
+
+			Variable::VariableType type = collection.deref().type;
+			if (type != Variable::VariableType::P_Map && type != Variable::VariableType::P_Int && type != Variable::VariableType::P_Double)
+			{
+				aaLang->error() << "Runtime Error: 1st parameter of parallelMap() must be a Map or a number!" << std::endl;
+				return aaLang->null;
+			}
+			if (block.type != Variable::VariableType::P_Block && block.type != Variable::VariableType::P_String)
+			{
+				aaLang->error() << "Runtime Error: 2nd parameter of parallelMap() must be a block!" << std::endl;
+				return aaLang->null;
+			}
+
+			return runParallel(aaLang, collection, 0, block, nullptr);
+		}
+	));
+	registerFunction(
+		new Function("parallelThreads", 1, [](AALang* aaLang, Arguments& args) {
+			int64_t threads = args[0].integer();
+			aaLang->parallelThreads = threads > 0 ? (size_t)threads : 0;
+			aaLang->pool.reset();
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("setMap", 3, [](AALang*, Arguments& args) {
+			Variable& map = args[0];
+			if (map.type != Variable::VariableType::P_Map)
+				map = Variable::map();
+			map.mapValues()[args[1]] = args[2];
+
+			return map;
+		}
+	));
+	registerFunction(
+		new Function("getMap", 2, [](AALang* aaLang, Arguments& args) {
+			Variable& lVal = args[0];
+			if (lVal.type != Variable::VariableType::P_Map)
+				return aaLang->null;
+
+			Variable* found = lVal.mapValues().find(args[1]);
+			if (!found)
+				return aaLang->null;
+
+			return *found;
+		}
+	));
+	registerFunction(
+		new Function("if", 2, [](AALang* aaLang, Arguments& args) {
+			if (args[0].integer())
+			{
+				Variable block = args[1];
+				args.release();
+				aaLang->executeBlock(&block);
+			}
 
-				while ((int)(executeBlock(eval->sValue)->fValue) != 0)
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("ifelse", 3, [](AALang* aaLang, Arguments& args) {
+			Variable block = args[0].integer() ? args[1] : args[2];
+			args.release();
+			aaLang->executeBlock(&block);
+
+			return aaLang->null;
+			}
+	));
+	registerFunction(
+		new Function("print", 1, [](AALang* aaLang, Arguments& args) {
+			aaLang->output.write(args[0]);
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("flush", 0, [](AALang* aaLang, Arguments&) {
+			aaLang->output.flush();
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("outputFile", 1, [](AALang* aaLang, Arguments& args) {
+			std::string path(args[0].type == Variable::VariableType::P_String ? args[0].string() : std::string_view());
+			if (!aaLang->output.redirect(path))
+			{
+				aaLang->error() << "Runtime Error: outputFile() could not open " << path << ", writing to the console" << std::endl;
+				return Variable((int64_t)0);
+			}
+			return Variable((int64_t)1);
+		}
+	));
+	registerFunction(
+		new Function("outputBuffer", 1, [](AALang* aaLang, Arguments& args) {
+			int64_t size = args[0].integer();
+			aaLang->output.setBufferSize(size > 0 ? (size_t)size : 0);
+			return aaLang->null;
+		}
+	));
+	//registerFunction(
+	//	new Function("printv", 3, [](AALang* aaLang, Arguments& args) {
+
+	//		int params = args[0].number();
+
+	//		for (int i = 0; i < params; ++i)
+	//		{
+	//			std::cout << args[i + 1].toString() << std::endl;
+	//		}
+	//		aaLang->null;
+	//	}
+	//));
+	registerFunction(
+		new Function("equals", 2, [](AALang*, Arguments& args) {
+			return equalsValues(args[0], args[1]);
+		}, true
+	));
+	registerFunction(
+		new Function("lt", 2, [](AALang*, Arguments& args) {
+			return ltValues(args[0], args[1]);
+		}, true
+	));
+	registerFunction(
+		new Function("gt", 2, [](AALang*, Arguments& args) {
+			Variable& v1 = args[0];
+			Variable& v2 = args[1];
+
+			if (integers(v1, v2))
+				return Variable((int64_t)(intValue(v1) > intValue(v2)));
+			return Variable((int64_t)(v1.number() > v2.number()));
+		}, true
+	));
+	registerFunction(
+		new Function("lte", 2, [](AALang*, Arguments& args) {
+			Variable& v1 = args[0];
+			Variable& v2 = args[1];
+
+			if (integers(v1, v2))
+				return Variable((int64_t)(intValue(v1) <= intValue(v2)));
+			return Variable((int64_t)(v1.number() <= v2.number()));
+		}, true
+	));
+	registerFunction(
+		new Function("gte", 2, [](AALang*, Arguments& args) {
+			Variable& v1 = args[0];
+			Variable& v2 = args[1];
+
+			if (integers(v1, v2))
+				return Variable((int64_t)(intValue(v1) >= intValue(v2)));
+			return Variable((int64_t)(v1.number() >= v2.number()));
+		}, true
+	));
+	registerFunction(
+		new Function("add", 2, [](AALang*, Arguments& args) {
+			return addValues(args[0], args[1]);
+		}, true
+	));
+	registerFunction(
+		new Function("sub", 2, [](AALang*, Arguments& args) {
+			return subValues(args[0], args[1]);
+		}, true
+	));
+	registerFunction(
+		new Function("mul", 2, [](AALang*, Arguments& args) {
+			return mulValues(args[0], args[1]);
+		}, true
+	));
+	registerFunction(
+		new Function("div", 2, [](AALang*, Arguments& args) {
+			return Variable(args[0].number() / args[1].number());
+		}, true
+	));
+	registerFunction(
+		new Function("mod", 2, [](AALang* aaLang, Arguments& args) {
+			Variable& v1 = args[0];
+			Variable& v2 = args[1];
+
+			if (integers(v1, v2))
+			{
+				if (intValue(v2) == 0)
 				{
-					executeBlock(block->sValue);
+					aaLang->error() << "Runtime Error: mod() by zero" << std::endl;
+					return aaLang->null;
 				}
-				return null;
+				// INT64_MIN % -1 overflows, the remainder is 0 for any dividend
+				if (intValue(v2) == -1)
+					return Variable((int64_t)0);
+				return Variable(intValue(v1) % intValue(v2));
+			}
+			return Variable(std::fmod(v1.number(), v2.number()));
+		}
+	));
+	registerFunction(
+		new Function("abs", 1, [](AALang*, Arguments& args) {
+			Variable& v1 = args[0];
+
+			// -INT64_MIN doesn't fit, that one becomes a double
+			if (integral(v1) && intValue(v1) != INT64_MIN)
+				return Variable(intValue(v1) < 0 ? -intValue(v1) : intValue(v1));
+			return Variable(std::abs(v1.number()));
+			}, true
+	));
+	registerFunction(
+		new Function("and", 2, [](AALang*, Arguments& args) {
+			return Variable((int64_t)(args[0].integer() && args[1].integer()));
+		}, true
+	));
+	registerFunction(
+		new Function("or", 2, [](AALang*, Arguments& args) {
+			return Variable((int64_t)(args[0].integer() || args[1].integer()));
+		}, true
+	));
+	registerFunction(
+		new Function("pop", 0, [](AALang* aaLang, Arguments& args) {
+			// the arguments of the running block sit right below this call's own
+			if (args.base == 0)
+			{
+				aaLang->error() << "Runtime Error: pop() called on an empty callstack" << std::endl;
+				return aaLang->null;
 			}
-		));
 
-		registerFunction(
-			new Function("foreach", 4, [this](CallStack* p) {
-			std::shared_ptr<Variable> v = p->top();
-			p->pop();
+			args.base--;
+			return args.stack->remove(args.base).deref();
+		}
+	));
+	registerFunction(
+		new Function("cmd", 1, [](AALang* aaLang, Arguments& args) {
+			std::string cmd(args[0].string());
+
+			// the commands started with cmdAsync() keep running meanwhile
+			int64_t handle = aaLang->eventLoop.startCommand(cmd);
+			std::string result;
+			if (handle < 0 || !aaLang->eventLoop.await(handle, result))
+			{
+				aaLang->error() << "Runtime Error: cmd() could not run " << cmd << loopFailure(aaLang->eventLoop) << std::endl;
+				return aaLang->null;
+			}
 
-			if (v->type != Variable::VariableType::P_Map)
+			return Variable(result);
+		}
+	));
+	registerFunction(
+		new Function("openFile", 2, [](AALang* aaLang, Arguments& args) {
+			std::string path(args[0].string());
+			std::string mode(args[1].string());
+
+			int64_t handle = aaLang->files.open(path, mode);
+			if (handle < 0)
+			{
+				aaLang->error() << "Runtime Error: openFile() could not open " << path << " with mode \"" << mode << "\"" << std::endl;
+				return aaLang->null;
+			}
+			return Variable(handle);
+		}
+	));
+	registerFunction(
+		new Function("readLine", 1, [](AALang* aaLang, Arguments& args) {
+			// null at the end of the file, a line from a mapped file is not copied
+			Variable line;
+			if (!aaLang->files.readLine(args[0].integer(), line))
+				return aaLang->null;
+			return line;
+		}
+	));
+	registerFunction(
+		new Function("readChunk", 2, [](AALang* aaLang, Arguments& args) {
+			int64_t size = args[1].integer();
+			Variable chunk;
+			if (size <= 0 || !aaLang->files.readChunk(args[0].integer(), (size_t)size, chunk))
+				return aaLang->null;
+			return chunk;
+		}
+	));
+	registerFunction(
+		new Function("eof", 1, [](AALang* aaLang, Arguments& args) {
+			return Variable((int64_t)aaLang->files.atEnd(args[0].integer()));
+		}
+	));
+	registerFunction(
+		new Function("write", 2, [](AALang* aaLang, Arguments& args) {
+			Output* output = aaLang->files.writer(args[0].integer());
+			if (!output)
+			{
+				aaLang->error() << "Runtime Error: 1st parameter of write() must be a file opened for writing!" << std::endl;
+				return aaLang->null;
+			}
+			output->write(args[1]);
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("writeLine", 2, [](AALang* aaLang, Arguments& args) {
+			Output* output = aaLang->files.writer(args[0].integer());
+			if (!output)
 			{
-				std::cout << "Runtime Error: 1st parameter of foreach() must be a Map!" << std::endl;
-				return null;
+				aaLang->error() << "Runtime Error: 1st parameter of writeLine() must be a file opened for writing!" << std::endl;
+				return aaLang->null;
 			}
+			output->write(args[1]);
+			output->write(std::string_view("\n"));
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("close", 1, [](AALang* aaLang, Arguments& args) {
+			return Variable((int64_t)aaLang->files.close(args[0].integer()));
+		}
+	));
+	registerFunction(
+		new Function("cmdAsync", 1, [](AALang* aaLang, Arguments& args) {
+			std::string cmd(args[0].string());
 
-			std::shared_ptr<Variable> key = p->top();
-			p->pop();
-			std::shared_ptr<Variable> val = p->top();
-			p->pop();
+			int64_t handle = aaLang->eventLoop.startCommand(cmd);
+			if (handle < 0)
+			{
+				aaLang->error() << "Runtime Error: cmdAsync() could not run " << cmd << loopFailure(aaLang->eventLoop) << std::endl;
+				return aaLang->null;
+			}
+			return Variable(handle);
+		}
+	));
+	registerFunction(
+		new Function("readFileAsync", 1, [](AALang* aaLang, Arguments& args) {
+			std::string path(args[0].string());
 
-			std::shared_ptr<Variable> block = p->top();
-			p->pop();
+			int64_t handle = aaLang->eventLoop.startRead(path);
+			if (handle < 0)
+			{
+				aaLang->error() << "Runtime Error: readFileAsync() could not read " << path << loopFailure(aaLang->eventLoop) << std::endl;
+				return aaLang->null;
+			}
+			return Variable(handle);
+		}
+	));
+	registerFunction(
+		new Function("await", 1, [](AALang* aaLang, Arguments& args) {
+			if (args[0].type != Variable::VariableType::P_Int)
+			{
+				aaLang->error() << "Runtime Error: 1st parameter of await() must be a handle from cmdAsync() or readFileAsync()!" << std::endl;
+				return aaLang->null;
+			}
 
+			// a handle can be awaited once, the result is the output or the file contents
+			std::string result;
+			if (!aaLang->eventLoop.await(args[0].iValue, result))
+			{
+				aaLang->error() << "Runtime Error: await() got an unknown handle or an unreadable file" << loopFailure(aaLang->eventLoop) << std::endl;
+				return aaLang->null;
+			}
+			return Variable(result);
+		}
+	));
+	registerFunction(
+		new Function("cmdStatus", 0, [](AALang* aaLang, Arguments&) {
+			// like $? in a shell, for the last command cmd() or await() finished
+			return Variable((int64_t)aaLang->eventLoop.lastStatus);
+		}
+	));
+	registerFunction(
+		new Function("getFileContents", 1, [](AALang* aaLang, Arguments& args) {
+			std::string path(args[0].string());
 
-			if (block->type != Variable::VariableType::P_Block)
+			auto file = std::make_shared<MappedFile>(path);
+			if (!file->isOpen())
 			{
-				std::cout << "Runtime Error: 2nd parameter of foreach() must be a block!" << std::endl;
-				return null;
+				aaLang->error() << "getFileContents(" << path << ") Error: Unable to open file" << std::endl;
+				return aaLang->null;
 			}
 
-			isInForeach = true;
-			for(auto &i : v->mValue)
+			return Variable::mapped(file);
+		}
+	));
+	registerFunction(
+		new Function("cacheStats", 0, [](AALang* aaLang, Arguments&) {
+			Variable stats = Variable::map();
+			stats.mapValues()["hits"] = Variable((int64_t)aaLang->blockCache.hits);
+			stats.mapValues()["misses"] = Variable((int64_t)aaLang->blockCache.misses);
+			stats.mapValues()["evictions"] = Variable((int64_t)aaLang->blockCache.evictions);
+			stats.mapValues()["size"] = Variable((int64_t)aaLang->blockCache.size());
+			stats.mapValues()["capacity"] = Variable((int64_t)aaLang->blockCache.capacity);
+			stats.mapValues()["interned"] = Variable((int64_t)aaLang->blockCache.interned());
+			stats.mapValues()["lines"] = Variable((int64_t)aaLang->lineCache.size());
+			stats.mapValues()["lineEvictions"] = Variable((int64_t)aaLang->lineCache.evictions);
+			return stats;
+		}
+	));
+	registerFunction(
+		new Function("gcStats", 0, [](AALang* aaLang, Arguments&) {
+			auto now = std::chrono::high_resolution_clock::now();
+			double seconds = std::chrono::duration<double>(now - aaLang->heap.lastSample).count();
+			double allocationRate = seconds > 0 ? (aaLang->heap.allocations - aaLang->heap.lastAllocations) / seconds : 0;
+			aaLang->heap.lastSample = now;
+			aaLang->heap.lastAllocations = aaLang->heap.allocations;
+
+			Variable stats = Variable::map();
+			stats.mapValues()["liveStrings"] = Variable((int64_t)aaLang->heap.liveStrings);
+			stats.mapValues()["liveMaps"] = Variable((int64_t)aaLang->heap.liveMaps);
+			stats.mapValues()["liveObjects"] = Variable((int64_t)aaLang->heap.liveBlocks);
+			stats.mapValues()["liveBytes"] = Variable((int64_t)aaLang->heap.liveBytes);
+			stats.mapValues()["arenaBytes"] = Variable((int64_t)aaLang->heap.arenaBytes);
+			stats.mapValues()["allocations"] = Variable((int64_t)aaLang->heap.allocations);
+			stats.mapValues()["allocationRate"] = Variable(allocationRate);
+			stats.mapValues()["collections"] = Variable((int64_t)aaLang->heap.collections);
+			stats.mapValues()["collected"] = Variable((int64_t)aaLang->heap.collected);
+			return stats;
+		}
+	));
+	registerFunction(
+		new Function("gc", 0, [](AALang* aaLang, Arguments&) {
+			return Variable((int64_t)aaLang->heap.collectCycles());
+		}
+	));
+	registerFunction(
+		new Function("assert", 2, [](AALang* aaLang, Arguments& args) {
+			if (!args[0].integer())
+				aaLang->error() << "Runtime Error: assert failed: " << args[1].toString() << std::endl;
+			return args[0];
+		}
+	));
+	registerFunction(
+		new Function("exit", 0, [](AALang* aaLang, Arguments&) {
+			aaLang->output.flush();
+			aaLang->writeProfile();
+			exit(aaLang->errors > 0 ? 1 : 0);
+			return aaLang->null;
+		}
+	));
+	registerFunction(
+		new Function("include", 1, [](AALang* aaLang, Arguments& args) {
+			std::string path(args[0].string());
+			args.release();
+
+			Program program;
+			loadProgram(path, &program, aaLang);
+			FrameScope frame(aaLang, &topLevel);
+			for (auto& i : program)
 			{
-				key->sValue = i.first;
-				key->type = Variable::VariableType::P_String;
+				aaLang->executeLine(i);
+			}
+			return aaLang->null;
+		}
+	));
+
+	// calls to these cost more than what they do, the compiler emits an opcode instead
+	compiler.inlineNative(functions["equals"], OpCode::OP_Equals);
+	compiler.inlineNative(functions["lt"], OpCode::OP_Lt);
+	compiler.inlineNative(functions["add"], OpCode::OP_Add);
+	compiler.inlineNative(functions["sub"], OpCode::OP_Sub);
+	compiler.lowerNative(functions["while"]);
+	compiler.lowerNative(functions["if"]);
+	compiler.lowerNative(functions["ifelse"]);
+	compiler.lowerNative(functions["foreach"]);
+}
+
+// the arguments are the top argumentCount entries of the CallStack, in order
+// for a builtin, reversed so the first one is popped first for a block
+Variable AALang::call(std::string identifier, size_t argumentCount)
+{
+	auto toCall = functions.find(identifier);
+	if (toCall != functions.end())
+	{
+		return callNative(toCall->second, argumentCount);
+	}
+
+	return callBlock(identifier);
+}
+
+Variable AALang::callNative(Function* function, size_t argumentCount)
+{
+	ProfileScope profile(profiler ? profiler->enter(profiler->nativeName(function)) : nullptr);
+	return function->execute(this, &callStack, argumentCount);
+}
+
+Variable AALang::callBlock(std::string identifier)
+{
+	Variable* target = findVariable(identifier);
+	if (!target)
+	{
+		//return null
+		return null;
+	}
+
+	return executeBlock(target);
+}
+
+Variable AALang::callBlock(int slot)
+{
+	if (!globalDefined[slot])
+	{
+		//return null
+		return null;
+	}
+
+	return executeBlock(&globals[slot]);
+}
+
+void AALang::pushFrame(const std::vector<int>& names)
+{
+	size_t base = locals.size();
+	locals.resize(base + names.size());
+	localDefined.resize(base + names.size(), false);
+	frames.push_back({ base, &names });
+}
+
+void AALang::popFrame()
+{
+	size_t base = frames.back().base;
+	frames.pop_back();
+	locals.resize(base);
+	localDefined.resize(base);
+}
+
+// where the running block keeps the name of global slot in its frame, -1 when it doesn't
+int AALang::findLocal(int slot)
+{
+	if (frames.empty())
+		return -1;
+
+	const Frame& frame = frames.back();
+	for (size_t i = 0; i < frame.names->size(); ++i)
+	{
+		if ((*frame.names)[i] == slot)
+			return (int)(frame.base + i);
+	}
+
+	return -1;
+}
+
+Function* AALang::registerFunction(Function* newFunc)
+{
+	//std::cout << "Registered Function: " << newFunc->identifier << "()" << std::endl;
+	// a redefinition takes over the index of the old one, compiled calls follow it
+	auto existing = functions.find(newFunc->identifier);
+	if (existing != functions.end() && existing->second == newFunc)
+	{
+		return newFunc;
+	}
+	else if (existing != functions.end())
+	{
+		newFunc->index = existing->second->index;
+		natives[newFunc->index] = newFunc;
+
+		// nothing else points at the old one, another Function may get its address
+		compiler.forgetNative(existing->second);
+		if (profiler)
+			profiler->forgetNative(existing->second);
+		delete existing->second;
+	}
+	else
+	{
+		newFunc->index = (int)natives.size();
+		natives.push_back(newFunc);
+	}
+	functions[newFunc->identifier] = newFunc;
+
+	return newFunc;
+}
+
+// in the running block's frame when it keeps identifier there
+Variable* AALang::assignVariable(std::string identifier, Variable newVar)
+{
+	int slot = resolveGlobal(identifier);
+	int local = findLocal(slot);
+	if (local < 0)
+		return assignVariable(slot, std::move(newVar));
+
+	locals[local] = std::move(newVar);
+	localDefined[local] = true;
+	return &locals[local];
+}
+
+Variable* AALang::assignVariable(int slot, Variable newVar)
+{
+	globals[slot] = std::move(newVar);
+	globalDefined[slot] = true;
+
+	return &globals[slot];
+}
+
+int AALang::resolveGlobal(const std::string& identifier)
+{
+	auto slot = globalSlots.find(identifier);
+	if (slot != globalSlots.end())
+		return slot->second;
+
+	// slots are handed out on first sight and stay undefined until assigned
+	int newSlot = (int)globals.size();
+	globals.emplace_back();
+	globalDefined.push_back(false);
+	globalNames.push_back(identifier);
+	globalSlots[identifier] = newSlot;
+
+	return newSlot;
+}
+
+void AALang::collectBlocks()
+{
+	HeapScope scope(&heap);
+	heap.collectCycles();
+
+	std::vector<bool> live(blockCache.idCount(), false);
+	auto mark = [&](const Variable& value) {
+		if (value.type == Variable::VariableType::P_Block)
+			live[value.blockId] = true;
+	};
+
+	for (auto& global : globals)
+		mark(global);
+	for (auto& local : locals)
+		mark(local);
+	for (auto& value : operandStack)
+		mark(value);
+	for (auto& value : callStack.cs)
+		mark(value);
+	for (auto& iteration : iterations)
+	{
+		mark(iteration.map);
+		mark(iteration.key);
+		mark(iteration.value);
+	}
+	heap.markBlocks(live);
+
+	// literal blocks are constants of the chunks that contain them
+	blockCache.markCached(live);
+	lineCache.forEach([&](Chunk& chunk) {
+		for (auto& constant : chunk.constants)
+			mark(constant);
+	});
+
+	for (int blockId : blockCache.release(live))
+	{
+		if (profiler)
+			profiler->forgetBlock(blockId);
+	}
+}
+
+void AALang::maybeCollectBlocks()
+{
+	if (running > 0 || blockCache.interned() < nextBlockCollection)
+		return;
+
+	collectBlocks();
+	nextBlockCollection = std::max(minimumBlockCollection, blockCache.interned() * 2);
+}
+
+Variable* AALang::findVariable(const std::string& identifier)
+{
+	auto slot = globalSlots.find(identifier);
+	if (slot == globalSlots.end())
+		return nullptr;
 
-				val->sValue = i.second->sValue;
-				val->fValue = i.second->fValue;
-				val->mValue = i.second->mValue;
-				val->type = i.second->type;
+	int local = findLocal(slot->second);
+	if (local >= 0)
+		return localDefined[local] ? &locals[local] : nullptr;
 
-				executeBlock(block->sValue);
+	return globalDefined[slot->second] ? &globals[slot->second] : nullptr;
+}
+
+// Single pass over the statement. Tokens are views into line, the caller
+// keeps it alive for as long as the tokens are used. Escapes are resolved
+// into the string token's constant. Lines and columns count from the start
+// of line.
+void AALang::tokenizeLine(std::string_view line, TokenList* list)
+{
+	size_t size = line.size();
+	size_t i = 0;
+	int lineNumber = 1;
+	size_t lineStart = 0;
+
+	// strings and blocks may span lines
+	auto countLines = [&](size_t from, size_t to) {
+		for (size_t j = from; j < to; ++j)
+		{
+			if (line[j] == '\n')
+			{
+				lineNumber++;
+				lineStart = j + 1;
 			}
-			isInForeach = false;
+		}
+	};
+
+	while (i < size)
+	{
+		char v = line[i];
+		size_t start = i;
+		int startLine = lineNumber;
+		int column = (int)(i - lineStart) + 1;
+
+		if (v == '\n')
+		{
+			lineNumber++;
+			lineStart = ++i;
+			continue;
+		}
+		if (v == ' ' || v == '\t' || v == '\r')
+		{
+			i++;
+			continue;
+		}
+
+		if (isIdentifierChar(v))
+		{
+			while (i < size && (isIdentifierChar(line[i]) || isDigitChar(line[i])))
+				i++;
+			list->emplace_back(line.substr(start, i - start), Token::TokenType::T_Identifier, lineNumber, column);
+			continue;
+		}
 
-			return null;
+		// a '-' right in front of a number is its sign, unless it follows an operand
+		bool sign = v == '-' && i + 1 < size && isNumericChar(line[i + 1]) && (list->empty() || !isOperand(list->back()));
+		if (isNumericChar(v) || sign)
+		{
+			i++;
+			while (i < size && isNumericChar(line[i]))
+				i++;
+			list->emplace_back(line.substr(start, i - start), Token::TokenType::T_Number, lineNumber, column);
+			if (list->back().constant.type == Variable::VariableType::P_NULL)
+				error() << "Parse Error: Invalid number '" << list->back().value << "' at line " << lineNumber << ", column " << column << std::endl;
+			continue;
 		}
-		));
-		registerFunction(
-			new Function("value", 0, [this](CallStack* p) {
-				if (!isInForeach)
+
+		if (v == '"')
+		{
+			std::string value;
+			size_t run = ++i;
+			while (i < size && line[i] != '"')
+			{
+				if (line[i] != '\\' || i + 1 == size)
 				{
-					std::cout << "Runtime Error: value() cannot be called outside of foreach()" << std::endl;
-					return null;
+					i++;
+					continue;
 				}
-				return value;
-			}
-		));
-		registerFunction(
-			new Function("setMap", 3, [](CallStack* p) {
-				std::shared_ptr<Variable> lVal = p->top();
-				p->pop();
-				std::string key = p->top()->toString();
-				p->pop();
-				std::shared_ptr<Variable> rVal = p->top();
-				p->pop();
-
-				lVal->type = Variable::VariableType::P_Map;
-				lVal->mValue[key] = rVal;
-
-				return lVal;
-			}
-		));
-		registerFunction(
-			new Function("getMap", 2, [](CallStack* p) {
-				std::shared_ptr<Variable> lVal = p->top();
-				p->pop();
-				std::string key = p->top()->toString();
-				p->pop();
-
-				return lVal->mValue[key];
-			}
-		));
-		registerFunction(
-			new Function("if", 2, [this](CallStack* p) {
-				int eval = p->top()->fValue;
-				p->pop();
-
-				std::shared_ptr<Variable> block = p->top();
-				
-				if (eval)
+
+				char escaped = line[i + 1];
+				char replacement;
+				if (escaped == 'n')
+					replacement = '\n';
+				else if (escaped == 'r')
+					replacement = '\r';
+				else if (escaped == 't')
+					replacement = '\t';
+				else if (escaped == '\\' || escaped == '"')
+					replacement = escaped;
+				else
 				{
-					executeBlock(block->sValue);
+					// unknown escapes are kept as written
+					i += 2;
+					continue;
 				}
 
-				p->pop();
-				return null;
+				value.append(line.data() + run, i - run);
+				value += replacement;
+				i += 2;
+				run = i;
 			}
-		));
-		registerFunction(
-			new Function("ifelse", 3, [this](CallStack* p) {
-				int eval = p->top()->fValue;
-				p->pop();
-				if (!eval)
-					p->pop();
 
-				std::shared_ptr<Variable> block = p->top();
-				executeBlock(block->sValue);
+			if (i >= size)
+			{
+				error() << "Parse Error: Quote mismatch at line " << startLine << ", column " << column << std::endl;
+				return;
+			}
 
-				if (eval)
-					p->pop();
+			value.append(line.data() + run, i - run);
+			countLines(start, i);
+			i++;
 
-				p->pop();
-				return null;
-				}
-		));
-		registerFunction(
-			new Function("print", 1, [this](CallStack* p) {
-				std::cout << p->top()->toString();
-				p->pop();
-				return null;
-			}
-		));
-		//registerFunction(
-		//	new Function("printv", 3, [](CallStack* p) {
-
-		//		int params = p->top()->fValue;
-		//		p->pop();
-
-		//		for (int i = 0; i < params; ++i)
-		//		{
-		//			std::cout << p->top()->toString() << std::endl;
-		//			p->pop();
-		//		}
-		//		null;
-		//	}
-		//));
-		registerFunction(
-			new Function("equals", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 == v2);
-				}
-		));
-		registerFunction(
-			new Function("lt", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 < v2);
-			}
-		));
-		registerFunction(
-			new Function("gt", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 > v2);
-				}
-		));
-		registerFunction(
-			new Function("lte", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 <= v2);
-				}
-		));
-		registerFunction(
-			new Function("gte", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 >= v2);
-				}
-		));
-		registerFunction(
-			new Function("add", 2, [](CallStack* p) {
-				bool isStringV1 = p->top()->type == Variable::VariableType::P_String;
-				std::string v1s = p->top()->sValue;
-				float v1 = p->top()->fValue;
-				p->pop();
-
-				bool isStringV2 = p->top()->type == Variable::VariableType::P_String;
-				std::string v2s = p->top()->sValue;
-				float v2 = p->top()->fValue;
-				p->pop();
-
-				if (isStringV1 && isStringV2)
-					return std::make_shared<Variable>(v1s + v2s);
-
-				return std::make_shared<Variable>(v1 + v2);
-			}
-		));
-		registerFunction(
-			new Function("sub", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 - v2);
-			}
-		));
-		registerFunction(
-			new Function("mul", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(v1 * v2);
-			}
-		));
-		registerFunction(
-			new Function("div", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p ->pop();
-				return std::make_shared<Variable>(v1 / v2);
-			}
-		));
-		registerFunction(
-			new Function("mod", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>(((int)v1 % (int)v2));
-			}
-		));
-		registerFunction(
-			new Function("abs", 1, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>((std::abs(v1)));
-				}
-		));
-		registerFunction(
-			new Function("and", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>((int)v1 && (int)v2);
-			}
-		));
-		registerFunction(
-			new Function("or", 2, [](CallStack* p) {
-				float v1 = p->top()->fValue;
-				p->pop();
-				float v2 = p->top()->fValue;
-				p->pop();
-				return std::make_shared<Variable>((int)v1 || (int)v2);
-			}
-		));
-		registerFunction(
-			new Function("pop", 0, [](CallStack* p) {
-				std::shared_ptr<Variable> temp = std::make_shared<Variable>();
-				temp->sValue = p->top()->sValue;
-				temp->fValue = p->top()->fValue;
-				temp->type = p->top()->type;
-				p->pop();
-				return temp;
-			}
-		));
-		registerFunction(
-			new Function("cmd", 1, [](CallStack* p) {
-				std::string cmd = p->top()->sValue;
-				p->pop();
-
-				std::array<char, 128> buffer;
-				std::string result;
-				std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(cmd.c_str(), "r"), _pclose);
-				if (!pipe) {
-					throw std::runtime_error("popen() failed!");
-				}
-				while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-					result += buffer.data();
+			Token token(line.substr(start + 1, i - start - 2), Token::TokenType::T_String, startLine, column);
+			token.constant = Variable(value);
+			list->push_back(std::move(token));
+			continue;
+		}
+
+		if (v == '{')
+		{
+			int blockCount = 1;
+			bool inQuote = false;
+			i++;
+			while (i < size)
+			{
+				char c = line[i++];
+				if (inQuote)
+				{
+					if (c == '\\')
+						i++;
+					else if (c == '"')
+						inQuote = false;
 				}
+				else if (c == '"')
+					inQuote = true;
+				else if (c == '{')
+					blockCount++;
+				else if (c == '}' && --blockCount == 0)
+					break;
+			}
 
-				return std::make_shared<Variable>(result);
+			if (blockCount != 0)
+			{
+				error() << "Parse Error: Block mismatch at line " << startLine << ", column " << column << std::endl;
+				return;
 			}
-		));
-		registerFunction(
-			new Function("getFileContents", 1, [this](CallStack* p) {
-				std::string path = p->top()->sValue;
 
-				std::ifstream file(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-				if (!file)
+			countLines(start, i);
+			list->emplace_back(line.substr(start + 1, i - start - 2), Token::TokenType::T_Block, startLine, column);
+			continue;
+		}
+
+		Token::TokenType type;
+		switch (v)
+		{
+		case '=':
+			type = Token::TokenType::T_AssignmentOperator;
+			break;
+		case '+':
+		case '-':
+		case '*':
+		case '/':
+			type = Token::TokenType::T_ArithmeticOperator;
+			break;
+		case ';':
+			type = Token::TokenType::T_EndOfLine;
+			break;
+		case '(':
+			type = Token::TokenType::T_OpenParenthesis;
+			break;
+		case ')':
+			type = Token::TokenType::T_CloseParenthesis;
+			break;
+		case '[':
+			type = Token::TokenType::T_OpenSquareBracket;
+			break;
+		case ']':
+			type = Token::TokenType::T_CloseSquareBracket;
+			break;
+		case ',':
+			type = Token::TokenType::T_Comma;
+			break;
+		default:
+			// anything else is skipped, as it always has been
+			i++;
+			continue;
+		}
+
+		list->emplace_back(line.substr(i, 1), type, lineNumber, column);
+		i++;
+	}
+}
+
+Variable AALang::executeBlock(std::string block)
+{
+	return executeBlock(blockCache.intern(block));
+}
+
+Variable AALang::executeBlock(Variable* block)
+{
+	// anything that isn't a block literal is executed as source, as it always has been
+	Variable& target = block->deref();
+	if (target.type != Variable::VariableType::P_Block)
+		return executeBlock(std::string(target.string()));
+
+	return executeBlock(target.blockId);
+}
+
+Variable AALang::executeBlock(int blockId)
+{
+	HeapScope scope(&heap);
+	Running block(running);
+	Variable ret;
+	CachedBlock& cached = blockCache.get(blockId);
+	ProfileScope profile(profiler ? profiler->enter(profiler->blockName(blockId, blockCache.source(blockId))) : nullptr);
+
+	// only the tree-walker runs a block where the compiler would have inlined it
+	bool shared = inlineBlocks;
+	inlineBlocks = false;
+
+	if (!treeWalk)
+	{
+		if (!cached.chunk)
+		{
+			ProfileScope compiling(profiler ? profiler->enter(profiler->name("compile")) : nullptr);
+			cached.chunk = std::shared_ptr<Chunk>(compiler.compileBlock(blockCache.source(blockId)));
+		}
+
+		std::shared_ptr<Chunk> chunk = cached.chunk;
+		FrameScope frame(this, &chunk->locals);
+		ret = run(chunk.get());
+	}
+	else
+	{
+		const std::string& block = blockCache.source(blockId);
+		if (!cached.program)
+		{
+			cached.program = std::make_shared<Program>();
+			preParse(block, block.size(), cached.program.get());
+		}
+		if (!cached.locals)
+		{
+			cached.locals = std::make_shared<std::vector<int>>();
+			compiler.collectLocals(block, *cached.locals);
+		}
+
+		std::shared_ptr<Program> program = cached.program;
+		std::shared_ptr<std::vector<int>> names = cached.locals;
+		FrameScope frame(this, shared ? nullptr : names.get());
+		for (auto& i : *program)
+		{
+			ret = executeLine(i);
+		}
+	}
+
+	inlineBlocks = shared;
+	return ret;
+}
+
+Variable AALang::index(Variable container, Variable& index, bool createIfNotExists)
+{
+	Variable& map = container.deref();
+
+	// only hand out a reference into a map some variable is holding on to
+	if (createIfNotExists && container.type == Variable::VariableType::P_Ref)
+	{
+		if (map.type != Variable::VariableType::P_Map)
+			map = Variable::map();
+
+		return Variable::reference(&map.mapValues()[index.deref()]);
+	}
+
+	if (map.type != Variable::VariableType::P_Map)
+		return null;
+
+	Variable* found = map.mapValues().find(index.deref());
+	if (!found)
+		return null;
+
+	return *found;
+}
+
+// starts a foreach over a map or up to a number. key and value are written
+// through for every element.
+bool AALang::beginIteration(Variable collection, Variable key, Variable value)
+{
+	Variable& c = collection.deref();
+	if (c.type == Variable::VariableType::P_Int || c.type == Variable::VariableType::P_Double)
+	{
+		iterations.push_back({ Variable(), std::move(key), std::move(value), VariableMap::iterator(), -1, c.integer(), false });
+		return true;
+	}
+
+	if (c.type != Variable::VariableType::P_Map)
+	{
+		error() << "Runtime Error: 1st parameter of foreach() must be a Map or a number!" << std::endl;
+		return false;
+	}
+
+	iterations.push_back({ c, std::move(key), std::move(value), VariableMap::iterator(), 0, 0, false });
+	Iteration& iteration = iterations.back();
+	iteration.position = iteration.map.mapValues().begin();
+	return true;
+}
+
+// moves the innermost foreach to its next element, once there is none left
+// the loop is removed and false returned
+bool AALang::nextIteration()
+{
+	Iteration& iteration = iterations.back();
+	if (iteration.map.type != Variable::VariableType::P_Map)
+	{
+		if (++iteration.index >= iteration.count)
+		{
+			iterations.pop_back();
+			return false;
+		}
+
+		iteration.key.deref() = Variable(iteration.index);
+		iteration.value.deref() = Variable(iteration.index);
+		return true;
+	}
+
+	// advanced only once the body ran, so it sees what the body added
+	VariableMap& values = iteration.map.mapValues();
+	if (iteration.started)
+		++iteration.position;
+	iteration.started = true;
+
+	if (iteration.position == values.end())
+	{
+		iterations.pop_back();
+		return false;
+	}
+
+	iteration.key.deref() = iteration.position.key();
+	iteration.value.deref() = iteration.position.value();
+	return true;
+}
+
+Variable AALang::processImmediate(Token& in, bool createIfNotExists)
+{
+	Variable immediate;
+	if (in.type == Token::TokenType::T_Identifier)
+	{
+		Variable* v = findVariable(std::string(in.value));
+		if (v != nullptr)
+		{
+			immediate = Variable::reference(v);
+		}
+		else if (createIfNotExists)
+		{
+			immediate = Variable::reference(assignVariable(std::string(in.value), Variable()));
+		}
+		else
+		{
+			//return NULL
+			error() << "Parse Error: Unknown Identifier '" << in.value << "'" << std::endl;
+		}
+	}
+	else if (in.type == Token::TokenType::T_Number || in.type == Token::TokenType::T_String)
+	{
+		immediate = in.constant;
+	}
+	else if (in.type == Token::TokenType::T_Block)
+	{
+		if (createIfNotExists)
+		{
+			// run right where it is written, in this frame
+			inlineBlocks = true;
+			immediate = executeBlock(std::string(in.value));
+			inlineBlocks = false;
+		}
+		else
+		{
+			immediate = Variable::block(blockCache.intern(std::string(in.value)));
+		}
+	}
+	else
+	{
+		error() << "Parse Error: Unexpected Token '" << in.value << " " << in.typeToString() << "'" << std::endl;
+	}
+
+	return immediate;
+}
+
+Variable AALang::evaluateExpression(TokenList* list, bool createIfNotExists)
+{
+	// return null if expression is empty
+	if (list->empty())
+	{
+		return null;
+	}
+	else
+	{
+		// is immediate value ?
+		if (list->size() == 1)
+		{
+			return processImmediate(list->at(0), createIfNotExists);
+		}
+		else
+		{
+			if (list->at(1).type == Token::TokenType::T_OpenSquareBracket) //must be an array index
+			{
+				bool foundMatchingSquareBracket = false;
+				TokenList subList;
+				for (size_t i = 2; i < list->size(); ++i)
+				{
+					auto currentType = list->at(i).type;
+					if (currentType == Token::TokenType::T_CloseSquareBracket)
+					{
+						foundMatchingSquareBracket = true;
+						break;
+					}
+					subList.push_back(list->at(i));
+				}
+				if (foundMatchingSquareBracket)
 				{
-					std::cout << "getFileContents(" << path << ") Error: Unable to open file" << std::endl;
+					Variable indexV = evaluateExpression(&subList);
+					Variable val = processImmediate(list->at(0), createIfNotExists);
+
+					return index(val, indexV, createIfNotExists);
+				}
+				else
+				{
+					error() << "Parse Error: square bracket mismatch, returning NULL" << std::endl;
 					return null;
 				}
+			}
+			if (list->size() >= 3)
+			{
+				if (list->at(0).type == Token::TokenType::T_Identifier && list->at(1).type == Token::TokenType::T_OpenParenthesis)
+				{
+					int parenthesisCount = 0;
+					std::string identifier(list->at(0).value);
 
-				char* data = nullptr;
-				size_t size = 0;
+					TokenList subList;
+					// evaluated aside first, an argument may pop() the arguments of the running block
+					std::vector<Variable> arguments;
+					std::vector<bool> literals;
 
-				size = file.tellg();
-				file.seekg(0, file.beg);
-				data = new char[size];
-				file.read(data, size);
-				file.close();
+					for (size_t i = 2; i < list->size()-1; ++i)
+					{
+						auto currentType = list->at(i).type;
 
-				return std::shared_ptr<Variable>(new Variable(std::string(data, size)));
-			}
-		));
-		registerFunction(
-			new Function("exit", 0, [this](CallStack* p) {
-				exit(0);
-				return null;
-			}
-		));
-		registerFunction(
-			new Function("include", 1, [this](CallStack* p) {
-				std::string path = p->top()->sValue;
-				p->pop();
+						if (currentType == Token::TokenType::T_OpenParenthesis)
+						{
+							parenthesisCount++;
+						}
+						else if (currentType == Token::TokenType::T_CloseParenthesis)
+						{
+							parenthesisCount--;
+						}
+						
 
-				Program program;
-				loadProgram(path, &program, this);
-				for (auto& i : program)
-				{
-					std::shared_ptr<Variable> result = executeLine(i);
+						if (parenthesisCount == 0)
+						{
+							if (currentType == Token::TokenType::T_Comma)
+							{
+								literals.push_back(subList.size() == 1 && subList.at(0).type == Token::TokenType::T_Block);
+								arguments.push_back(evaluateExpression(&subList));
+								subList.clear();
+							}
+							else
+							{
+								subList.push_back(list->at(i));
+							}
+						}
+						else
+						{
+							subList.push_back(list->at(i));
+						}
+					}
+					if (!subList.empty())
+					{
+						literals.push_back(subList.size() == 1 && subList.at(0).type == Token::TokenType::T_Block);
+						arguments.push_back(evaluateExpression(&subList));
+						subList.clear();
+					}
+
+					if (parenthesisCount == 0)
+					{
+						if (functions.find(identifier) != functions.end())
+						{
+							for (auto& i : arguments)
+								callStack.push(std::move(i));
+
+							// the blocks of a call the compiler lowers share this frame
+							inlineBlocks = compiler.lowersCall(identifier, literals);
+							Variable ret = call(identifier, arguments.size());
+							inlineBlocks = false;
+							return ret;
+						}
+
+						// blocks take their arguments by value, a reference could point at a local of the caller
+						for (size_t i = arguments.size(); i > 0; --i)
+							callStack.push(arguments[i - 1].deref());
+						return call(identifier, arguments.size());
+					}
+					else
+					{
+						error() << "Parse Error: Parenthesis mismatch, returning NULL" << std::endl;
+						return null;
+					}
 				}
-				return null;
 			}
-		));
+		}
 	}
+	return null;
+}
+
+std::string AALang::TokenListToString(TokenList* list)
+{
+	std::ostringstream buf;
+	for (auto& i : *list)
+		buf << i.value << "[" << i.typeToString() << "]" << std::endl;
+
+	return buf.str();
+}
 
-	std::shared_ptr<Variable> call(std::string identifier)
+Variable AALang::executeTokens(TokenList* list)
+{
+	TokenList lParam;
+	TokenList rParam;
+	bool foundlParam = false;
+	bool assignment = false;
+	for (auto& i : *list)
 	{
-		auto toCall = functions.find(identifier);
-		if (toCall != functions.end())
-		{
-			if (!callStack.empty() || toCall->second->parameterCount == 0)
-			{
-				return toCall->second->execute(&callStack);
-			}
-			else
-			{
-				std::cout << "Runtime Error: Callstack is empty" << std::endl;
-			}
-		}
-		else if(variables.find(identifier) != variables.end())
+		if (i.type == Token::TokenType::T_AssignmentOperator)
 		{
-			return executeBlock(variables.at(identifier)->sValue);
+			foundlParam = true;
+			assignment = true;
 		}
 		else
 		{
-			//return null
-			return null;
-		}
+			if (i.type == Token::TokenType::T_EndOfLine)
+				continue;
 
-		std::cout << "Error: Call(" << identifier << ") returning nullptr" << std::endl;
-		return nullptr;
+			if (!foundlParam)
+				lParam.push_back(i);
+			else
+				rParam.push_back(i);
+		}
 	}
 
-	Function* registerFunction(Function* newFunc)
-	{
-		//std::cout << "Registered Function: " << newFunc->identifier << "()" << std::endl;
-		functions[newFunc->identifier] = newFunc;
+	Variable lParamV = evaluateExpression(&lParam, true);
+	Variable rParamV = evaluateExpression(&rParam);
 
-		return newFunc;
+	if (assignment)
+	{
+		lParamV.deref() = rParamV.deref();
 	}
+	else
+	{
+		if (lParamV.deref().type == Variable::VariableType::P_Block)
+			executeBlock(&lParamV);
+	}
+
+	return lParamV.deref();
+}
 
-	std::shared_ptr<Variable> assignVariable(std::string identifier, std::shared_ptr<Variable> newVar)
+Variable AALang::executeLine(std::string line)
+{
+	HeapScope scope(&heap);
+	maybeCollectBlocks();
+	Running statement(running);
+	ProfileScope profile(profiler ? profiler->enter(profiler->lineName(line)) : nullptr);
+	if (!treeWalk)
 	{
-		newVar->registered = true;
-		if (variables.find(identifier) != variables.end())
+		std::shared_ptr<Chunk> chunk;
 		{
-			//TODO: delete variables[identifier];
-			variables[identifier] = newVar;
+			ProfileScope lookup(profiler ? profiler->enter(profiler->name("lineCache lookup")) : nullptr);
+			chunk = lineCache.find(line);
 		}
-		else
+		if (!chunk)
 		{
-			variables[identifier] = newVar;
+			ProfileScope compiling(profiler ? profiler->enter(profiler->name("compile")) : nullptr);
+			chunk = std::shared_ptr<Chunk>(compiler.compileLine(line));
+			lineCache.insert(line, chunk);
 		}
 
-		return newVar;
+		return run(chunk.get());
 	}
 
-	void tokenizeLine(std::string line, TokenList* list)
+	std::shared_ptr<TokenizedLine> tokenized;
+	{
+		ProfileScope lookup(profiler ? profiler->enter(profiler->name("tokenCache lookup")) : nullptr);
+		tokenized = tokenCache.find(line);
+	}
+	if (!tokenized)
 	{
-		std::string currentValue;
-		bool foundIdentifier = 0;
-		bool foundNumber = 0;
-		bool foundString = 0;
-		bool inQuote = 0;
-		int blockCount = 0;
+		// the tokens point into the line they were made from, both live together
+		ProfileScope tokenizing(profiler ? profiler->enter(profiler->name("tokenize")) : nullptr);
+		tokenized = std::make_shared<TokenizedLine>();
+		tokenized->line = line;
+		tokenizeLine(tokenized->line, &tokenized->tokens);
+		tokenCache.insert(line, tokenized);
+	}
+
+	return executeTokens(&tokenized->tokens);
+}
+
+Variable AALang::run(Chunk* chunk)
+{
+	size_t base = operandStack.size();
+	size_t frameBase = frames.empty() ? 0 : frames.back().base;
+	Variable result;
+
+	const Instruction* code = chunk->code.data();
+	size_t pc = 0;
 
-		for (int i = 0; i < line.size(); ++i)
+	while (true)
+	{
+		const Instruction& in = code[pc++];
+		switch (in.op)
 		{
-			char v = line[i];
-			if (v == '"' && blockCount == 0)
-			{
-				inQuote = !inQuote;
-				continue;
-			}
-			if (!inQuote)
+		case OpCode::OP_PushConst:
+			operandStack.push_back(chunk->constants[in.a]);
+			break;
+		case OpCode::OP_PushNull:
+			operandStack.emplace_back();
+			break;
+		case OpCode::OP_LoadVar:
+		{
+			if (globalDefined[in.a])
 			{
-				if (v == '{')
-				{
-					blockCount++;
-					if(blockCount == 1)
-						continue;
-				}
-				else if (v == '}')
-				{
-					blockCount--;
-					if (blockCount == 0)
-					{
-						list->push_back(Token(currentValue, Token::TokenType::T_Block));
-						currentValue = "";
-						continue;
-					}
-				}
-				
-				if (blockCount > 0)
-				{
-					currentValue += v;
-					continue;
-				}
+				operandStack.push_back(Variable::reference(&globals[in.a]));
 			}
-			if (isNumericChar(v) && !foundIdentifier && !inQuote)
+			else if (in.b)
 			{
-				currentValue += v;
-				foundNumber = true;
+				operandStack.push_back(Variable::reference(assignVariable(in.a, Variable())));
 			}
-			if (isIdentifierChar(v) && !inQuote)
+			else
 			{
-				currentValue += v;
-				foundIdentifier = true;
-				foundNumber = false;
+				error() << "Parse Error: Unknown Identifier '" << globalNames[in.a] << "'" << std::endl;
+				operandStack.emplace_back();
 			}
-			if (inQuote)
+			break;
+		}
+		case OpCode::OP_StoreVar:
+		{
+			Variable& rParamV = operandStack.back();
+			if (rParamV.type == Variable::VariableType::P_Ref)
+				globals[in.a] = rParamV.deref();
+			else
+				globals[in.a] = std::move(rParamV);
+			globalDefined[in.a] = true;
+
+			if (in.b)
+				operandStack.pop_back();
+			else
+				rParamV = Variable::reference(&globals[in.a]);
+			break;
+		}
+		case OpCode::OP_LoadLocal:
+		{
+			size_t local = frameBase + in.a;
+			if (localDefined[local] || in.b)
 			{
-				currentValue += v;
-				foundString = true;
-				foundIdentifier = false;
-				foundNumber = false;
-				continue;
+				localDefined[local] = true;
+				operandStack.push_back(Variable::reference(&locals[local]));
 			}
-			if (v == '=' || v == ';' || v == '(' || v == ')' || v == '[' || v == ']' || v == ',' || v == '+' || v == '-' || v == '*' || v == '/')
+			else
 			{
-				if (foundIdentifier)
-				{
-					list->push_back(Token(currentValue, Token::TokenType::T_Identifier));
-				}
-				if (foundNumber)
-				{
-					list->push_back(Token(currentValue, Token::TokenType::T_Number));
-				}
-				if (foundString)
-				{
-					if (currentValue.find('\\') != -1)
-					{
-						currentValue = std::regex_replace(currentValue, std::regex("\\\\n"), "\n");
-						currentValue = std::regex_replace(currentValue, std::regex("\\\\r"), "\r");
-						currentValue = std::regex_replace(currentValue, std::regex("\\\\t"), "\t");
-					}
-					list->push_back(Token(currentValue, Token::TokenType::T_String));
-				}
-
-				foundIdentifier = false;
-				foundNumber = false;
-				foundString = false;
-
-				currentValue = "";
-
-				if(v == '=')
-					list->push_back(Token("=", Token::TokenType::T_AssignmentOperator));
-				if (v == '+')
-					list->push_back(Token("+", Token::TokenType::T_ArithmeticOperator));
-				if (v == '-')
-					list->push_back(Token("-", Token::TokenType::T_ArithmeticOperator));
-				if (v == '*')
-					list->push_back(Token("*", Token::TokenType::T_ArithmeticOperator));
-				if (v == '/')
-					list->push_back(Token("/", Token::TokenType::T_ArithmeticOperator));
-				if (v == ';')
-					list->push_back(Token(";", Token::TokenType::T_EndOfLine));
-				if (v == '(')
-					list->push_back(Token("(", Token::TokenType::T_OpenParenthesis));
-				if (v == ')')
-					list->push_back(Token(")", Token::TokenType::T_CloseParenthesis));
-				if (v == '[')
-					list->push_back(Token("[", Token::TokenType::T_OpenSquareBracket));
-				if (v == ']')
-					list->push_back(Token("]", Token::TokenType::T_CloseSquareBracket));
-				if (v == ',')
-					list->push_back(Token(",", Token::TokenType::T_Comma));
+				error() << "Parse Error: Unknown Identifier '" << globalNames[chunk->locals[in.a]] << "'" << std::endl;
+				operandStack.emplace_back();
 			}
+			break;
 		}
-		if (inQuote)
-		{
-			std::cout << "Parse Error: Quote mismatch." << std::endl;
-		}
-		if (blockCount != 0)
+		case OpCode::OP_StoreLocal:
 		{
-			std::cout << "Parse Error: Block mismatch" << std::endl;
-		}
-	}
-
-	std::shared_ptr<Variable> executeBlock(std::string block)
-	{
-		std::shared_ptr<Variable> ret = nullptr;
-		Program *t;
+			size_t local = frameBase + in.a;
+			Variable& rParamV = operandStack.back();
+			if (rParamV.type == Variable::VariableType::P_Ref)
+				locals[local] = rParamV.deref();
+			else
+				locals[local] = std::move(rParamV);
+			localDefined[local] = true;
 
-		if (preParseCache.find(block) == preParseCache.end())
-		{
-			t = new Program;
-			preParseCache[block] = t;
+			if (in.b)
+				operandStack.pop_back();
+			else
+				rParamV = Variable::reference(&locals[local]);
+			break;
 		}
-		else
+		case OpCode::OP_Assign:
 		{
-			t = preParseCache[block];
-		}
-
-		preParse(block, block.size(), t);
+			Variable rParamV = std::move(operandStack.back());
+			operandStack.pop_back();
 
-		for (auto& i : *t)
-		{
-			ret = executeLine(i);
+			operandStack.back().deref() = rParamV.deref();
+			break;
 		}
-
-		if (ret == nullptr)
+		case OpCode::OP_Index:
 		{
-			std::cout << "Error: executeBlock(" << block << ") returning nullptr." << std::endl;
-		}
-
-		return ret;
-	}
+			Variable val = std::move(operandStack.back());
+			operandStack.pop_back();
+			Variable indexV = std::move(operandStack.back());
+			operandStack.pop_back();
 
-	std::shared_ptr<Variable> processImmediate(Token in, bool createIfNotExists = false)
-	{
-		std::shared_ptr<Variable> immediate;
-		if (in.type == Token::TokenType::T_Identifier)
+			operandStack.push_back(index(val, indexV, in.a));
+			break;
+		}
+		case OpCode::OP_CallNative:
+		case OpCode::OP_CallBlock:
+		case OpCode::OP_CallLocal:
 		{
-			if (variables.find(in.value) != variables.end())
+			// a builtin sees its arguments in order, a block pops them so the first one goes on top.
+			// blocks take their arguments by value, a reference could point at a local of the caller
+			size_t argBase = operandStack.size() - in.b;
+			if (in.op == OpCode::OP_CallNative)
 			{
-				immediate = variables[in.value];
+				for (size_t i = argBase; i < operandStack.size(); ++i)
+					callStack.push(std::move(operandStack[i]));
 			}
 			else
 			{
-				if (createIfNotExists)
-				{
-					immediate = assignVariable(in.value, std::make_shared<Variable>());
-				}
-				else
+				for (size_t i = operandStack.size(); i > argBase; --i)
 				{
-					//return NULL
-					immediate = null;
-					std::cout << "Parse Error: Unknown Identifier '" << in.value << "'" << std::endl;
+					if (operandStack[i - 1].type == Variable::VariableType::P_Ref)
+						callStack.push(operandStack[i - 1].deref());
+					else
+						callStack.push(std::move(operandStack[i - 1]));
 				}
 			}
+			operandStack.resize(argBase);
+
+			if (in.op == OpCode::OP_CallNative)
+			{
+				Arguments args{ &callStack, callStack.size() - in.b, (size_t)in.b };
+				ProfileScope profile(profiler ? profiler->enter(profiler->nativeName(natives[in.a])) : nullptr);
+				operandStack.push_back(natives[in.a]->action(this, args));
+				callStack.truncate(args.base);
+			}
+			else if (in.op == OpCode::OP_CallBlock)
+			{
+				operandStack.push_back(callBlock(in.a));
+			}
+			else
+			{
+				size_t local = frameBase + in.a;
+				operandStack.push_back(localDefined[local] ? executeBlock(&locals[local]) : null);
+			}
+			break;
 		}
-		else if (in.type == Token::TokenType::T_Number)
+		case OpCode::OP_Equals:
 		{
-			immediate = std::shared_ptr<Variable>(new Variable(std::stof(in.value)));
+			if (in.b)
+			{
+				operandStack.back() = equalsValues(operandStack.back().deref(), chunk->constants[in.a]);
+				break;
+			}
+			Variable ret = equalsValues(operandStack[operandStack.size() - 2].deref(), operandStack.back().deref());
+			operandStack.pop_back();
+			operandStack.back() = std::move(ret);
+			break;
 		}
-		else if (in.type == Token::TokenType::T_String)
+		case OpCode::OP_Lt:
 		{
-			immediate = std::shared_ptr<Variable>(new Variable(in.value));
+			if (in.b)
+			{
+				operandStack.back() = ltValues(operandStack.back().deref(), chunk->constants[in.a]);
+				break;
+			}
+			Variable ret = ltValues(operandStack[operandStack.size() - 2].deref(), operandStack.back().deref());
+			operandStack.pop_back();
+			operandStack.back() = std::move(ret);
+			break;
 		}
-		else if (in.type == Token::TokenType::T_Block)
+		case OpCode::OP_Add:
 		{
-			if (createIfNotExists)
+			if (in.b)
 			{
-				immediate = executeBlock(in.value);
+				operandStack.back() = addValues(operandStack.back().deref(), chunk->constants[in.a]);
+				break;
 			}
-			else
+			Variable ret = addValues(operandStack[operandStack.size() - 2].deref(), operandStack.back().deref());
+			operandStack.pop_back();
+			operandStack.back() = std::move(ret);
+			break;
+		}
+		case OpCode::OP_Sub:
+		{
+			if (in.b)
 			{
-				immediate = std::shared_ptr<Variable>(new Variable(in.value, true));
+				operandStack.back() = subValues(operandStack.back().deref(), chunk->constants[in.a]);
+				break;
 			}
+			Variable ret = subValues(operandStack[operandStack.size() - 2].deref(), operandStack.back().deref());
+			operandStack.pop_back();
+			operandStack.back() = std::move(ret);
+			break;
 		}
-		else
+		case OpCode::OP_ExecIfBlock:
 		{
-			std::cout << "Parse Error: Unexpected Token '" << in.value << " " << in.typeToString() << "'" << std::endl;
+			if (operandStack.back().deref().type == Variable::VariableType::P_Block)
+			{
+				Variable top = operandStack.back().deref();
+				executeBlock(&top);
+			}
+			break;
 		}
-
-		if (immediate == nullptr)
+		case OpCode::OP_Jump:
+			pc = in.a;
+			break;
+		case OpCode::OP_JumpIfFalse:
 		{
-			std::cout << "Error: processImmediate(" << in.value << " [" << in.typeToString() << "]) returning nullptr." << std::endl;
+			bool jump = operandStack.back().integer() == 0;
+			operandStack.pop_back();
+			if (jump)
+				pc = in.a;
+			break;
 		}
-
-		return immediate;
-	}
-
-	std::shared_ptr<Variable> evaluateExpression(TokenList* list, bool createIfNotExists = false)
-	{
-		// return null if expression is empty
-		if (list->empty())
+		case OpCode::OP_JumpIfTrue:
 		{
-			return null;
+			bool jump = operandStack.back().integer() != 0;
+			operandStack.pop_back();
+			if (jump)
+				pc = in.a;
+			break;
 		}
-		else
+		case OpCode::OP_IterInit:
 		{
-			bool isFunction = 0;
-			// is immediate value ?
-			if (list->size() == 1)
-			{
-				return processImmediate(list->at(0), createIfNotExists);
-			}
+			Variable val = std::move(operandStack.back());
+			operandStack.pop_back();
+			Variable key = std::move(operandStack.back());
+			operandStack.pop_back();
+			Variable collection = operandStack.back().deref();
+			operandStack.pop_back();
+
+			if (!beginIteration(std::move(collection), std::move(key), std::move(val)))
+				pc = in.a;
+			break;
+		}
+		case OpCode::OP_IterNext:
+		{
+			if (!nextIteration())
+				pc = in.a;
+			break;
+		}
+		case OpCode::OP_EndStatement:
+		{
+			Variable& top = operandStack.back();
+			if (top.type == Variable::VariableType::P_Ref)
+				result = top.deref();
 			else
-			{
-				if (list->at(1).type == Token::TokenType::T_OpenSquareBracket) //must be an array index
-				{
-					bool foundMatchingSquareBracket = false;
-					TokenList subList;
-					for (int i = 2; i < list->size(); ++i)
-					{
-						auto currentType = list->at(i).type;
-						if (currentType == Token::TokenType::T_CloseSquareBracket)
-						{
-							foundMatchingSquareBracket = true;
-							break;
-						}
-						subList.push_back(list->at(i));
-					}
-					if (foundMatchingSquareBracket)
-					{
-						std::shared_ptr<Variable> index = evaluateExpression(&subList);
-						std::shared_ptr<Variable> val = processImmediate(list->at(0), createIfNotExists);
-						if (val)
-						{
-							if (createIfNotExists)
-							{
-								val->mValue[index->toString()] = null;
-								val->type = Variable::VariableType::P_Map;
-							}
-						}
-
-						return val->mValue[index->toString()];
-					}
-					else
-					{
-						std::cout << "Parse Error: square bracket mismatch, returning nullptr" << std::endl;
-						return nullptr;
-					}
-				}
-				if (list->size() >= 3)
-				{
-					if (list->at(0).type == Token::TokenType::T_Identifier && list->at(1).type == Token::TokenType::T_OpenParenthesis)
-					{
-						isFunction = true;
-						int parenthesisCount = 0;
-						std::string identifier = list->at(0).value;
-
-						TokenList subList;
-						std::stack<std::shared_ptr<Variable>> stack;
-
-						for (int i = 2; i < list->size()-1; ++i)
-						{
-							auto currentType = list->at(i).type;
-
-							if (currentType == Token::TokenType::T_OpenParenthesis)
-							{
-								parenthesisCount++;
-							}
-							else if (currentType == Token::TokenType::T_CloseParenthesis)
-							{
-								parenthesisCount--;
-							}
-							
-
-							if (parenthesisCount == 0)
-							{
-								if (currentType == Token::TokenType::T_Comma)
-								{
-									stack.push(evaluateExpression(&subList));
-									subList.clear();
-								}
-								else
-								{
-									subList.push_back(list->at(i));
-								}
-							}
-							else
-							{
-								subList.push_back(list->at(i));
-							}
-						}
-						if (!subList.empty())
-						{
-							stack.push(evaluateExpression(&subList));
-							subList.clear();
-						}
-
-						if (parenthesisCount == 0)
-						{
-							while (!stack.empty())
-							{
-								callStack.push(stack.top());
-								stack.pop();
-							}
-							return call(identifier);
-						}
-						else
-						{
-							std::cout << "Parse Error: Parenthesis mismatch, returning nullptr" << std::endl;
-							return nullptr;
-						}
-					}
-				}
-			}
+				result = std::move(top);
+			operandStack.pop_back();
+			break;
+		}
+		case OpCode::OP_Pop:
+			operandStack.pop_back();
+			break;
+		case OpCode::OP_Return:
+			operandStack.resize(base);
+			return result;
 		}
-		return nullptr;
 	}
+}
+
+// Splits a source file into top level statements. Comments, carriage
+// returns and line breaks inside string literals are dropped, everything
+// else is copied over in runs.
+void AALang::preParse(std::string_view data, size_t size, Program* p)
+{
+	int blockCount = 0;
+	bool inQuote = false;
+	size_t run = 0;
 
-	std::string TokenListToString(TokenList* list)
+	p->push_back("");
+	for (size_t i = 0; i < size; ++i)
 	{
-		std::ostringstream buf;
-		for (auto& i : *list)
-			buf << i.value << "[" << i.typeToString() << "]" << std::endl;
+		char c = data[i];
 
-		return buf.str();
-	}
+		// statements start at their first non blank character
+		if (run == i && p->back().empty() && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+		{
+			run = i + 1;
+			continue;
+		}
 
-	std::shared_ptr<Variable> executeTokens(TokenList* list)
-	{
-		TokenList lParam;
-		TokenList rParam;
-		bool foundlParam = false;
-		bool assignment = false;
-		for (auto& i : *list)
+		if (inQuote)
 		{
-			if (i.type == Token::TokenType::T_AssignmentOperator)
+			if (c == '\\' && i + 1 < size && data[i + 1] != '\n' && data[i + 1] != '\r')
 			{
-				foundlParam = true;
-				assignment = true;
+				i++;
 			}
-			else
+			else if (c == '"')
 			{
-				if (i.type == Token::TokenType::T_EndOfLine)
-					continue;
-
-				if (!foundlParam)
-					lParam.push_back(i);
-				else
-					rParam.push_back(i);
+				inQuote = false;
+			}
+			else if (c == '\n' || c == '\r')
+			{
+				p->back().append(data.substr(run, i - run));
+				run = i + 1;
 			}
+			continue;
 		}
 
-		std::shared_ptr<Variable> lParamV = evaluateExpression(&lParam, true);
-		std::shared_ptr<Variable> rParamV = evaluateExpression(&rParam);
-
-		if (assignment)
+		if (c == '/' && i + 1 < size && data[i + 1] == '/')
 		{
-			lParamV->type = rParamV->type;
-			lParamV->fValue = rParamV->fValue;
-			lParamV->sValue = rParamV->sValue;
-
+			p->back().append(data.substr(run, i - run));
+			while (i + 1 < size && data[i + 1] != '\n')
+				i++;
+			run = i + 1;
+			continue;
 		}
-		else
+
+		if (c == '"')
 		{
-			if (lParamV)
-			{
-				if (lParamV->type == Variable::VariableType::P_Block)
-					executeBlock(lParamV->sValue);
-			}
+			inQuote = true;
 		}
-
-		if (lParamV == nullptr)
+		else if (c == '{')
 		{
-			std::cout << "Error: executeTokens(" << std::endl << TokenListToString(list) << ") returning nullptr." << std::endl;
+			blockCount++;
 		}
-
-		return lParamV;
-	}
-
-	std::shared_ptr<Variable> executeLine(std::string line)
-	{
-		TokenList *tokens;
-		if (tokenCache.find(line) == tokenCache.end())
+		else if (c == '}')
 		{
-			tokens = new TokenList();
-			tokenizeLine(line, tokens);
-			tokenCache[line] = tokens;
+			blockCount--;
 		}
-		else
+		else if (c == '\r')
 		{
-			tokens = tokenCache[line];
+			p->back().append(data.substr(run, i - run));
+			run = i + 1;
 		}
-
-		std::shared_ptr<Variable> ret = executeTokens(tokens);
-		
-		if (ret == nullptr)
-			std::cout << "Error: executeLine(" << line << ") returning nullptr." << std::endl;
-
-		//std::cout << std::endl;
-		/*for (auto& i : tokens)
+		else if (c == ';' && blockCount == 0)
 		{
-			std::cout << "" << i.value << "" << "\t(" << i.typeToString() <<  ")" << std::endl;
-		}*/
-		return ret;
+			p->back().append(data.substr(run, i + 1 - run));
+			p->push_back("");
+			run = i + 1;
+		}
 	}
-
-	void preParse(std::string data, size_t size, Program* p)
+	p->pop_back();
+	if (inQuote)
 	{
-		int blockCount = 0;
-		int inQuote = 0;
-
-		p->push_back("");
-		for (int i = 0; i < size; ++i)
-		{
-			if (!inQuote)
-			{
-				if (size - i > 1)
-				{
-					if (data[i] == '/' && data[i + 1] == '/')
-					{
-						while (data[++i] != '\n');
-					}
-				}
-
-				if (data[i] == '{')
-					blockCount++;
-				else if (data[i] == '}')
-					blockCount--;
-			}
-
-			if (data[i] == '"')
-				inQuote = !inQuote;
+		error() << "PreParse Error: Quote mismatch" << std::endl;
+	}
+	if (blockCount != 0)
+	{
+		error() << "PreParse Error: Block mismatch" << std::endl;
+	}
+}
 
-			if (data[i] != '\n' && data[i] != '\r')
-			{
-				p->back() += data[i];
-			}
 
-			if (data[i] == ';' && !inQuote && blockCount == 0)
-				p->push_back("");
-		}
-		p->pop_back();
-		if (blockCount != 0)
-		{
-			std::cout << "PreParse Error: Block mismatch" << std::endl;
-		}
+std::shared_ptr<const CompiledScript> AALang::compileScript(const std::filesystem::path& path)
+{
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		error() << "Unable to open file: " << path << std::endl;
+		return nullptr;
 	}
 
-	std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+	HeapScope scope(&heap);
+	std::string_view data = file.view();
+	Program program;
+	preParse(data, data.size(), &program);
 
-	bool isInForeach;
-	std::shared_ptr<Variable> value;
-	std::shared_ptr<Variable> null;
+	ScriptCache cache(this);
+	std::shared_ptr<CompiledScript> script = std::make_shared<CompiledScript>();
+	script->sourceHash = ScriptCache::hash(data);
+	script->image = cache.serialize(script->sourceHash, program);
+	return script;
+}
 
-	std::map<std::string, Program*> preParseCache;
-	std::map<std::string, TokenList*> tokenCache;
-	CallStack callStack;
-	std::map<std::string, Function*> functions;
-	std::map<std::string, std::shared_ptr<Variable>> variables;
-};
+bool AALang::loadScript(const CompiledScript& script, Program* p)
+{
+	HeapScope scope(&heap);
+	ScriptCache cache(this);
+	return cache.load(std::string_view(script.image), script.sourceHash, p);
+}
 
 void loadProgram(std::filesystem::path filepath, Program *p, AALang* aaLang)
 {
 	if (!std::filesystem::exists(filepath))
 	{
-		std::cout << "Path does not exist: " << filepath << std::endl;
+		aaLang->error() << "Path does not exist: " << filepath << std::endl;
 		return;
 	}
 
 	if(!std::filesystem::is_regular_file(filepath))
 	{
-		std::cout << "Path is not a file: " << filepath << std::endl;
+		aaLang->error() << "Path is not a file: " << filepath << std::endl;
 		return;
 	}
 
-	std::ifstream file(filepath, std::ios::in | std::ios::binary | std::ios::ate);
-	if (!file)
+	MappedFile file(filepath);
+	if (!file.isOpen())
 	{
-		std::cout << "Unable to open file: " << filepath << std::endl;
+		aaLang->error() << "Unable to open file: " << filepath << std::endl;
 		return;
 	}
 
-	char* data = nullptr;
-	size_t size = 0;
+	HeapScope scope(&aaLang->heap);
+	std::string_view data = file.view();
+	if (aaLang->treeWalk || !aaLang->useScriptCache)
+	{
+		aaLang->preParse(data, data.size(), p);
+		return;
+	}
 
-	size = file.tellg();
-	file.seekg(0, file.beg);
-	data = new char[size];
-	file.read(data, size);
-	file.close();
+	ScriptCache cache(aaLang);
+	uint64_t hash = ScriptCache::hash(data);
+	std::filesystem::path compiledPath = ScriptCache::cachePath(filepath);
+	if (cache.load(compiledPath, hash, p))
+		return;
 
-	aaLang->preParse(std::string(data, size), size, p);
+	size_t errors = aaLang->errors;
+	Program program;
+	aaLang->preParse(data, data.size(), &program);
+	if (aaLang->errors == errors)
+		cache.save(compiledPath, hash, program);
+	p->insert(p->end(), program.begin(), program.end());
 }
 
-int main()
+void loadSource(std::string_view source, Program* p, AALang* aaLang)
 {
-	AALang* aaLang = new AALang();
-
-	Program program;
-	loadProgram("test.aal", &program, aaLang);
-
-	int lineNum = 1;
-	for (auto& i : program)
-	{
-		std::shared_ptr<Variable> result = aaLang->executeLine(i);
-		if (result != nullptr)
-		{
-			std::cout << ">> " <<  result->toString() << std::endl;
-		}
-		else
-		{
-			std::cout << "Error: nullptr returned on line " << lineNum << std::endl;
-		}
-		lineNum++;
-	}
-	std::string cmd;
-	while (true)
-	{
-		std::cout << ">> ";
-		std::getline(std::cin, cmd);
-		if (cmd == "quit" || cmd == "exit")
-			break; 
-
-		std::shared_ptr<Variable> result = aaLang->executeLine(cmd);
-		if (result != nullptr)
-		{
-			std::cout << ">> " << result->toString() << std::endl;
-		}
-		else
-		{
-			std::cout << "Error: nullptr returned on line " << lineNum << std::endl;
-		}
-	}
-}
\ No newline at end of file
+	HeapScope scope(&aaLang->heap);
+	aaLang->preParse(source, source.size(), p);
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <filesystem>
+
+#include "Variable.h"
+#include "Token.h"
+#include "CallStack.h"
+#include "Function.h"
+#include "Bytecode.h"
+#include "Compiler.h"
+#include "BlockCache.h"
+#include "Heap.h"
+#include "Output.h"
+#include "ScriptCache.h"
+#include "Parallel.h"
+#include "EventLoop.h"
+#include "Files.h"
+#include "Profiler.h"
+#include "StatementCache.h"
+
+struct AALang;
+
+// a statement and the tokens pointing into it
+struct TokenizedLine
+{
+	std::string line;
+	TokenList tokens;
+};
+
+void loadProgram(std::filesystem::path filepath, Program* p, AALang* aaLang);
+void loadSource(std::string_view source, Program* p, AALang* aaLang);
+
+// One interpreter. Everything it touches hangs off this object (plus the
+// heap it installs for the calling thread), so separate instances can run
+// on separate threads without locking, see runInterpreters().
+struct AALang
+{
+	AALang();
+	~AALang();
+	AALang(const AALang&) = delete;
+	AALang& operator=(const AALang&) = delete;
+
+	void registerSTDLib();
+
+	// compiles a script with this interpreter's builtins, for any number of
+	// interpreters to load from without parsing it again
+	std::shared_ptr<const CompiledScript> compileScript(const std::filesystem::path& path);
+	bool loadScript(const CompiledScript& script, Program* p);
+
+	Variable call(std::string identifier, size_t argumentCount);
+	Variable callNative(Function* function, size_t argumentCount);
+	Variable callBlock(std::string identifier);
+	Variable callBlock(int slot);
+	Function* registerFunction(Function* newFunc);
+	Variable* assignVariable(std::string identifier, Variable newVar);
+	Variable* assignVariable(int slot, Variable newVar);
+	int resolveGlobal(const std::string& identifier);
+	Variable* findVariable(const std::string& identifier);
+	void pushFrame(const std::vector<int>& names);
+	void popFrame();
+	int findLocal(int slot);
+
+	void tokenizeLine(std::string_view line, TokenList* list);
+	void preParse(std::string_view data, size_t size, Program* p);
+
+	Variable executeBlock(std::string block);
+	Variable executeBlock(Variable* block);
+	Variable executeBlock(int blockId);
+	Variable executeLine(std::string line);
+	Variable index(Variable container, Variable& index, bool createIfNotExists);
+	bool beginIteration(Variable collection, Variable key, Variable value);
+	bool nextIteration();
+
+	// tree-walking interpreter, only used when treeWalk is set
+	Variable processImmediate(Token& in, bool createIfNotExists = false);
+	Variable evaluateExpression(TokenList* list, bool createIfNotExists = false);
+	Variable executeTokens(TokenList* list);
+	std::string TokenListToString(TokenList* list);
+
+	// bytecode interpreter
+	Variable run(Chunk* chunk);
+
+	std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+
+	// declared before anything holding Variables so it is destroyed last
+	Heap heap;
+
+	// print() writes here, buffered
+	Output output;
+
+	// runs parallelFor/parallelMap, started on first use with
+	// parallelThreads threads, 0 for one per core
+	std::unique_ptr<ThreadPool> pool;
+	size_t parallelThreads;
+
+	// cmdAsync() and readFileAsync() run here until await()
+	EventLoop eventLoop;
+
+	// opened with openFile()
+	Files files;
+
+	// set by startProfiling(), the report is written when the interpreter
+	// goes away or the script calls exit()
+	std::unique_ptr<Profiler> profiler;
+	std::string profilePath;
+	void startProfiling(const std::string& path);
+	void writeProfile();
+
+	// runtime and parse errors reported so far, the exit code depends on it
+	size_t errors;
+	std::ostream& error();
+
+	// the args map and argc a script sees, args[0] is the script itself
+	void setArguments(const std::vector<std::string>& arguments);
+
+	bool treeWalk;
+	bool useScriptCache;
+	Variable null;
+
+	BlockCache blockCache;
+	StatementCache<TokenizedLine> tokenCache;
+
+	Compiler compiler;
+	StatementCache<Chunk> lineCache;
+
+	// Block ids no value refers to any more are handed back to the block
+	// cache now and then. It only happens between top level statements,
+	// while nothing runs that could hold an id in a C++ local.
+	void collectBlocks();
+	void maybeCollectBlocks();
+	size_t running;
+	size_t nextBlockCollection;
+	std::vector<Variable> operandStack;
+
+	// running foreach loops, innermost last. A map is walked in place, a
+	// number n counts from 0 to n - 1 without building a map.
+	struct Iteration
+	{
+		Variable map;
+		Variable key;
+		Variable value;
+		VariableMap::iterator position;
+		int64_t index;
+		int64_t count;
+		bool started;
+	};
+	std::vector<Iteration> iterations;
+
+	CallStack callStack;
+	std::unordered_map<std::string, Function*> functions;
+	// the same builtins indexed by Function::index
+	std::vector<Function*> natives;
+
+	// globals live in a flat slot array, the compiler resolves identifiers to
+	// slots once and globalSlots is only consulted for names seen at runtime.
+	// A deque so references to a global stay valid as new slots are added.
+	std::deque<Variable> globals;
+	std::vector<bool> globalDefined;
+	std::vector<std::string> globalNames;
+	std::unordered_map<std::string, int> globalSlots;
+
+	// Every block run that the compiler didn't inline gets a frame: the names
+	// it assigns before reading them (see Compiler::collectLocals) live in
+	// consecutive locals from base on, any other name is a global. A callee
+	// never sees its caller's locals and a recursive call can't clobber them.
+	// A deque so references to a local stay valid as frames are pushed.
+	struct Frame
+	{
+		size_t base;
+		const std::vector<int>* names;
+	};
+	std::vector<Frame> frames;
+	std::deque<Variable> locals;
+	std::vector<bool> localDefined;
+
+	// set while the tree-walker runs a builtin the compiler would have
+	// lowered, the blocks it runs share the caller's frame like jumps do
+	bool inlineBlocks;
+};
@@ -0,0 +1,132 @@
+#include "BlockCache.h"
+
+BlockCache::BlockCache(size_t capacity)
+	:capacity(capacity), hits(0), misses(0), evictions(0)
+{
+}
+
+int BlockCache::intern(const std::string& source)
+{
+	auto found = ids.find(source);
+	if (found != ids.end())
+		return found->second;
+
+	int blockId;
+	if (!freeIds.empty())
+	{
+		blockId = freeIds.back();
+		freeIds.pop_back();
+		sources[blockId] = source;
+		entries[blockId].released = false;
+	}
+	else
+	{
+		blockId = (int)sources.size();
+		sources.push_back(source);
+		entries.push_back({ CachedBlock(), false, false, lru.end() });
+	}
+	ids[source] = blockId;
+
+	return blockId;
+}
+
+const std::string& BlockCache::source(int blockId)
+{
+	return sources[blockId];
+}
+
+CachedBlock& BlockCache::get(int blockId)
+{
+	Entry& entry = entries[blockId];
+	if (entry.cached)
+	{
+		hits++;
+		lru.splice(lru.begin(), lru, entry.lruPosition);
+		return entry.block;
+	}
+
+	misses++;
+	while (capacity > 0 && lru.size() >= capacity)
+		evict();
+
+	lru.push_front(blockId);
+	entry.lruPosition = lru.begin();
+	entry.cached = true;
+
+	return entry.block;
+}
+
+void BlockCache::setCapacity(size_t newCapacity)
+{
+	capacity = newCapacity;
+	while (capacity > 0 && lru.size() > capacity)
+		evict();
+}
+
+size_t BlockCache::size()
+{
+	return lru.size();
+}
+
+void BlockCache::evict()
+{
+	// anything still executing holds its own reference to the program/chunk
+	Entry& entry = entries[lru.back()];
+	entry.block = CachedBlock();
+	entry.cached = false;
+	entry.lruPosition = lru.end();
+	lru.pop_back();
+	evictions++;
+}
+
+size_t BlockCache::interned()
+{
+	return sources.size() - freeIds.size();
+}
+
+size_t BlockCache::idCount()
+{
+	return sources.size();
+}
+
+void BlockCache::markCached(std::vector<bool>& live)
+{
+	for (int blockId : lru)
+	{
+		Chunk* chunk = entries[blockId].block.chunk.get();
+		if (!chunk)
+			continue;
+
+		for (auto& constant : chunk->constants)
+		{
+			if (constant.type == Variable::VariableType::P_Block)
+				live[constant.blockId] = true;
+		}
+	}
+}
+
+std::vector<int> BlockCache::release(const std::vector<bool>& live)
+{
+	std::vector<int> released;
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		Entry& entry = entries[i];
+		if (live[i] || entry.released)
+			continue;
+
+		if (entry.cached)
+		{
+			lru.erase(entry.lruPosition);
+			entry.block = CachedBlock();
+			entry.cached = false;
+			entry.lruPosition = lru.end();
+		}
+		ids.erase(sources[i]);
+		std::string().swap(sources[i]);
+		entry.released = true;
+		freeIds.push_back((int)i);
+		released.push_back((int)i);
+	}
+
+	return released;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "Token.h"
+#include "Bytecode.h"
+
+struct CachedBlock
+{
+	std::shared_ptr<Program> program;
+	std::shared_ptr<Chunk> chunk;
+	// the names the tree-walker keeps in the block's frame, a chunk has its own
+	std::shared_ptr<std::vector<int>> locals;
+};
+
+// Interns block sources to small integer ids and keeps the parsed/compiled
+// form of the most recently used blocks. A capacity of 0 disables the bound.
+// Evicting parsed data leaves the id alone, a Variable can hold on to its
+// blockId as long as it likes. Ids are only given back by release(), once
+// the interpreter has made sure no value refers to them any more.
+class BlockCache
+{
+public:
+	BlockCache(size_t capacity = 1024);
+
+	int intern(const std::string& source);
+	const std::string& source(int blockId);
+
+	CachedBlock& get(int blockId);
+	void setCapacity(size_t newCapacity);
+	size_t size();
+
+	// ids handed out and not released
+	size_t interned();
+	// every id is below this
+	size_t idCount();
+	// sets live[blockId] for every block a cached chunk refers to
+	void markCached(std::vector<bool>& live);
+	// forgets every id that isn't live, they are reused by intern()
+	std::vector<int> release(const std::vector<bool>& live);
+
+	size_t capacity;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+private:
+	struct Entry
+	{
+		CachedBlock block;
+		bool cached;
+		bool released;
+		std::list<int>::iterator lruPosition;
+	};
+
+	void evict();
+
+	std::unordered_map<std::string, int> ids;
+	std::deque<std::string> sources;
+	std::deque<Entry> entries;
+	std::list<int> lru;
+	std::vector<int> freeIds;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "Variable.h"
+
+enum class OpCode : uint8_t {
+	OP_PushConst = 0,	// push constants[a]
+	OP_PushNull,		// push null, also emitted for expressions that failed to compile
+	OP_LoadVar,			// push a reference to global slot a, create it when b != 0
+	OP_StoreVar,		// pop value, copy it into global slot a (created if needed), push a reference to it unless b != 0
+	OP_LoadLocal,		// OP_LoadVar for slot a of the running block's frame
+	OP_StoreLocal,		// OP_StoreVar for slot a of the running block's frame
+	OP_Assign,			// pop value, copy it into the reference on top of the stack
+	OP_Index,			// pop map, pop index, push map[index], create the entry and push a reference when a != 0
+	OP_CallNative,		// move b arguments to the CallStack and call AALang::natives[a] on them
+	OP_CallBlock,		// move b arguments to the CallStack and execute the block stored in global slot a
+	OP_CallLocal,		// OP_CallBlock for the block stored in slot a of the running block's frame
+	OP_Equals,			// pop two values, push equals() of them. When b != 0 the right one is constants[a] instead
+	OP_Lt,				// pop two values, push lt() of them, b as for OP_Equals
+	OP_Add,				// pop two values, push add() of them, b as for OP_Equals
+	OP_Sub,				// pop two values, push sub() of them, b as for OP_Equals
+	OP_ExecIfBlock,		// execute the block on top of the stack, leaving it in place
+	OP_Jump,			// pc = a
+	OP_JumpIfFalse,		// pop value, pc = a when it is zero
+	OP_JumpIfTrue,		// pop value, pc = a unless it is zero
+	OP_IterInit,		// pop value, key and map references of a foreach and start iterating, pc = a when it isn't a map
+	OP_IterNext,		// write the next key and value through the references, pc = a once the map is done
+	OP_EndStatement,	// pop the statement result into the block result register
+	OP_Pop,				// pop the statement result of a block compiled inline, nobody sees it
+	OP_Return,			// return the block result register
+};
+
+struct Instruction
+{
+	OpCode op;
+	int32_t a;
+	int32_t b;
+};
+
+// A compiled line or block. Operands index into the tables below so the
+// instruction stream itself stays small and trivially copyable.
+struct Chunk
+{
+	std::vector<Instruction> code;
+	std::vector<Variable> constants;
+	// the names a block keeps in its frame as global slots, in frame order
+	std::vector<int> locals;
+	// an error was reported while compiling it, never cached
+	bool failed = false;
+};
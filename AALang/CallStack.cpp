@@ -1,13 +1,19 @@
 #include "CallStack.h"
 
-void CallStack::push(std::shared_ptr<Variable> v)
+CallStack::CallStack()
 {
-	cs.push(v);
+	cs.reserve(256);
 }
 
-std::shared_ptr<Variable> CallStack::top()
+void CallStack::push(Variable v)
 {
-	return cs.top();
+	cs.push_back(std::move(v));
+}
+
+// references are resolved here, builtins see the variable they were passed
+Variable& CallStack::top()
+{
+	return cs.back().deref();
 }
 
 size_t CallStack::size()
@@ -20,8 +26,23 @@ bool CallStack::empty()
 	return cs.empty();
 }
 
-void CallStack::pop()
+// returns the entry as pushed, so a builtin can keep writing through a reference
+Variable CallStack::pop()
+{
+	Variable v = std::move(cs.back());
+	cs.pop_back();
+	return v;
+}
+
+Variable CallStack::remove(size_t position)
 {
-	//delete cs.top();
-	cs.pop();
-}
\ No newline at end of file
+	Variable v = std::move(cs[position]);
+	cs.erase(cs.begin() + position);
+	return v;
+}
+
+void CallStack::truncate(size_t newSize)
+{
+	if (newSize < cs.size())
+		cs.resize(newSize);
+}
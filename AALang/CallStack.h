@@ -1,17 +1,47 @@
 #pragma once
-#include <stack>
-#include<memory>
-
-class Variable;
+#include <vector>
+#include "Variable.h"
 
+// Arguments on their way to a call. A native sees the arguments of its call
+// as a window onto the top of the stack, blocks pop() theirs one by one.
 class CallStack
 {
 public:
-	void push(std::shared_ptr<Variable> v);
-	std::shared_ptr<Variable> top();
+	CallStack();
+
+	void push(Variable v);
+	Variable& top();
 	size_t size();
 	bool empty();
-	void pop();
+	Variable pop();
+	Variable remove(size_t position);
+	void truncate(size_t newSize);
+
+	std::vector<Variable> cs;
+};
+
+// The arguments of one native call, args[0] is the first one. Kept as an
+// index rather than a pointer, a native that runs a block may grow the stack.
+struct Arguments
+{
+	// references are resolved here, builtins see the variable they were passed
+	Variable& operator[](size_t i)
+	{
+		return stack->cs[base + i].deref();
+	}
+	// the argument as passed, so a builtin can keep writing through a reference
+	Variable& raw(size_t i)
+	{
+		return stack->cs[base + i];
+	}
+	// drops the arguments, a block the builtin runs pops those of its caller
+	void release()
+	{
+		stack->truncate(base);
+		count = 0;
+	}
 
-	std::stack<std::shared_ptr<Variable>> cs;
-};
\ No newline at end of file
+	CallStack* stack;
+	size_t base;
+	size_t count;
+};
@@ -0,0 +1,643 @@
+#include <iostream>
+#include <algorithm>
+#include "Compiler.h"
+#include "Variable.h"
+#include "Function.h"
+#include "AALang.h"
+
+static const size_t minimumStringSweep = 1024;
+
+static bool isBlockLiteral(const TokenList& argument)
+{
+	return argument.size() == 1 && argument.at(0).type == Token::TokenType::T_Block;
+}
+
+Compiler::Compiler(AALang* aaLang)
+	:aaLang(aaLang), frame(nullptr), nextStringSweep(minimumStringSweep)
+{
+}
+
+Chunk* Compiler::compileBlock(std::string block)
+{
+	Chunk* chunk = new Chunk();
+	size_t errors = aaLang->errors;
+	const std::vector<int>* outer = frame;
+	collectLocals(block, chunk->locals);
+	frame = &chunk->locals;
+
+	Program program;
+	aaLang->preParse(block, block.size(), &program);
+	for (auto& i : program)
+	{
+		TokenList tokens;
+		aaLang->tokenizeLine(i, &tokens);
+		compileStatement(&tokens, chunk);
+	}
+	emit(chunk, OpCode::OP_Return);
+	chunk->failed = aaLang->errors != errors;
+	frame = outer;
+
+	return chunk;
+}
+
+Chunk* Compiler::compileLine(std::string line)
+{
+	Chunk* chunk = new Chunk();
+	size_t errors = aaLang->errors;
+	const std::vector<int>* outer = frame;
+	frame = nullptr;
+
+	TokenList tokens;
+	aaLang->tokenizeLine(line, &tokens);
+	compileStatement(&tokens, chunk);
+	emit(chunk, OpCode::OP_Return);
+	chunk->failed = aaLang->errors != errors;
+	frame = outer;
+
+	return chunk;
+}
+
+void Compiler::collectLocals(const std::string& block, std::vector<int>& locals)
+{
+	std::vector<int> globals;
+	collectLocals(block, locals, globals);
+}
+
+// globals collects the names read before anything assigned them, they stay
+// global for the rest of the block
+void Compiler::collectLocals(const std::string& block, std::vector<int>& locals, std::vector<int>& globals)
+{
+	Program program;
+	aaLang->preParse(block, block.size(), &program);
+	for (auto& statement : program)
+	{
+		TokenList tokens;
+		aaLang->tokenizeLine(statement, &tokens);
+
+		TokenList lParam;
+		TokenList rParam;
+		bool assignment = false;
+		for (auto& i : tokens)
+		{
+			if (i.type == Token::TokenType::T_AssignmentOperator)
+				assignment = true;
+			else if (i.type == Token::TokenType::T_EndOfLine)
+				continue;
+			else if (!assignment)
+				lParam.push_back(i);
+			else
+				rParam.push_back(i);
+		}
+
+		if (assignment && lParam.size() == 1 && lParam.at(0).type == Token::TokenType::T_Identifier)
+		{
+			// the value is evaluated before it is stored
+			collectReads(&rParam, locals, globals);
+			int slot = aaLang->resolveGlobal(std::string(lParam.at(0).value));
+			if (std::find(globals.begin(), globals.end(), slot) == globals.end() && std::find(locals.begin(), locals.end(), slot) == locals.end())
+				locals.push_back(slot);
+			continue;
+		}
+
+		// a statement starting with a block literal runs it right there
+		if (!lParam.empty() && lParam.at(0).type == Token::TokenType::T_Block)
+			collectLocals(std::string(lParam.at(0).value), locals, globals);
+		collectReads(&lParam, locals, globals);
+		collectReads(&rParam, locals, globals);
+	}
+}
+
+void Compiler::collectReads(TokenList* list, std::vector<int>& locals, std::vector<int>& globals)
+{
+	for (size_t i = 0; i < list->size(); ++i)
+	{
+		Token& token = list->at(i);
+		if (token.type != Token::TokenType::T_Identifier)
+			continue;
+
+		std::string identifier(token.value);
+		if (i + 1 < list->size() && list->at(i + 1).type == Token::TokenType::T_OpenParenthesis && aaLang->functions.count(identifier))
+		{
+			size_t close = i + 1;
+			for (int depth = 0; close < list->size(); ++close)
+			{
+				if (list->at(close).type == Token::TokenType::T_OpenParenthesis)
+					depth++;
+				else if (list->at(close).type == Token::TokenType::T_CloseParenthesis && --depth == 0)
+					break;
+			}
+			if (close == list->size())
+				continue;
+
+			// the bodies of a lowered call run as part of this block, in argument order
+			TokenList call(list->begin() + i, list->begin() + close + 1);
+			std::vector<TokenList> arguments;
+			std::vector<bool> literals;
+			splitCall(&call, arguments);
+			for (auto& argument : arguments)
+				literals.push_back(isBlockLiteral(argument));
+			if (!lowersCall(identifier, literals))
+				continue;
+
+			for (auto& argument : arguments)
+			{
+				if (isBlockLiteral(argument))
+					collectLocals(std::string(argument.at(0).value), locals, globals);
+				else
+					collectReads(&argument, locals, globals);
+			}
+			i = close;
+			continue;
+		}
+
+		int slot = aaLang->resolveGlobal(identifier);
+		if (std::find(locals.begin(), locals.end(), slot) == locals.end() && std::find(globals.begin(), globals.end(), slot) == globals.end())
+			globals.push_back(slot);
+	}
+}
+
+void Compiler::compileStatement(TokenList* list, Chunk* chunk, bool endStatement)
+{
+	TokenList lParam;
+	TokenList rParam;
+	bool foundlParam = false;
+	bool assignment = false;
+	for (auto& i : *list)
+	{
+		if (i.type == Token::TokenType::T_AssignmentOperator)
+		{
+			foundlParam = true;
+			assignment = true;
+		}
+		else
+		{
+			if (i.type == Token::TokenType::T_EndOfLine)
+				continue;
+
+			if (!foundlParam)
+				lParam.push_back(i);
+			else
+				rParam.push_back(i);
+		}
+	}
+
+	if (assignment)
+	{
+		// the tree-walker creates the lParam before evaluating the rParam, so
+		// only take the StoreVar shortcut when the rParam can't observe that.
+		bool selfReference = false;
+		if (lParam.size() == 1 && lParam.at(0).type == Token::TokenType::T_Identifier)
+		{
+			for (auto& i : rParam)
+			{
+				if (i.type == Token::TokenType::T_Identifier && i.value == lParam.at(0).value)
+					selfReference = true;
+			}
+		}
+
+		if (lParam.size() == 1 && lParam.at(0).type == Token::TokenType::T_Identifier && !selfReference)
+		{
+			compileExpression(&rParam, chunk);
+			emitStore(chunk, std::string(lParam.at(0).value));
+		}
+		else if (selfReference && readsFirst(&rParam, lParam.at(0).value))
+		{
+			// nothing runs before that read, creating the variable there is the same
+			int first = (int)chunk->code.size();
+			compileExpression(&rParam, chunk);
+			chunk->code[first].b = 1;
+			emitStore(chunk, std::string(lParam.at(0).value));
+		}
+		else
+		{
+			compileExpression(&lParam, chunk, true);
+			compileExpression(&rParam, chunk);
+			emit(chunk, OpCode::OP_Assign);
+		}
+	}
+	else
+	{
+		compileExpression(&lParam, chunk, true);
+
+		// the inlined builtins and lowered calls never leave a block behind
+		OpCode last = chunk->code.back().op;
+		if (last != OpCode::OP_Equals && last != OpCode::OP_Lt && last != OpCode::OP_Add && last != OpCode::OP_Sub && last != OpCode::OP_PushNull)
+			emit(chunk, OpCode::OP_ExecIfBlock);
+	}
+
+	if (endStatement)
+		emit(chunk, OpCode::OP_EndStatement);
+}
+
+// The statements of a block literal, compiled into the chunk that runs it.
+// With keepValue the value of the last statement is left on the stack, like
+// the result executeBlock() would have returned.
+void Compiler::compileInlineBlock(std::string block, Chunk* chunk, bool keepValue)
+{
+	Program program;
+	aaLang->preParse(block, block.size(), &program);
+	for (size_t i = 0; i < program.size(); ++i)
+	{
+		TokenList tokens;
+		aaLang->tokenizeLine(program[i], &tokens);
+		compileStatement(&tokens, chunk, false);
+		if (keepValue && i + 1 == program.size())
+			continue;
+
+		// a store whose result nobody reads doesn't need to push it
+		if (chunk->code.back().op == OpCode::OP_StoreVar || chunk->code.back().op == OpCode::OP_StoreLocal)
+			chunk->code.back().b = 1;
+		else
+			emit(chunk, OpCode::OP_Pop);
+	}
+
+	if (keepValue && program.empty())
+		emit(chunk, OpCode::OP_PushNull);
+}
+
+// Whether the first instruction compileExpression() emits for list reads
+// identifier, e.g. add(a, 1) for a.
+bool Compiler::readsFirst(TokenList* list, std::string_view identifier)
+{
+	if (list->size() == 1)
+		return list->at(0).type == Token::TokenType::T_Identifier && list->at(0).value == identifier;
+
+	if (list->size() < 4 || list->at(0).type != Token::TokenType::T_Identifier || list->at(1).type != Token::TokenType::T_OpenParenthesis)
+		return false;
+
+	auto native = aaLang->functions.find(std::string(list->at(0).value));
+	if (native != aaLang->functions.end() && lowered.count(native->second))
+		return false;
+
+	std::vector<TokenList> arguments;
+	if (!splitCall(list, arguments) || arguments.empty())
+		return false;
+	if (native != aaLang->functions.end() && arguments.size() < (size_t)native->second->parameterCount)
+		return false;
+
+	return readsFirst(&arguments[0], identifier);
+}
+
+bool Compiler::lowersCall(const std::string& identifier, const std::vector<bool>& literals)
+{
+	auto native = aaLang->functions.find(identifier);
+	if (native == aaLang->functions.end() || !lowered.count(native->second))
+		return false;
+
+	if (identifier == "while")
+		return literals.size() == 2 && literals[0] && literals[1];
+	if (identifier == "if")
+		return literals.size() == 2 && literals[1];
+	if (identifier == "ifelse")
+		return literals.size() == 3 && literals[1] && literals[2];
+	if (identifier == "foreach")
+		return literals.size() == 4 && literals[3];
+	return false;
+}
+
+// Lowers a call to while/if/ifelse/foreach into jumps. Returns false when a
+// block argument isn't a literal, the builtin is called as usual then.
+bool Compiler::compileControlFlow(const std::string& identifier, std::vector<TokenList>& arguments, Chunk* chunk)
+{
+	std::vector<bool> literals;
+	for (auto& argument : arguments)
+		literals.push_back(isBlockLiteral(argument));
+	if (!lowersCall(identifier, literals))
+		return false;
+
+	if (identifier == "while")
+	{
+		// the condition sits below the body, an iteration takes a single jump
+		int enter = emit(chunk, OpCode::OP_Jump);
+		int loop = (int)chunk->code.size();
+		compileInlineBlock(std::string(arguments[1].at(0).value), chunk, false);
+		chunk->code[enter].a = (int32_t)chunk->code.size();
+		compileInlineBlock(std::string(arguments[0].at(0).value), chunk, true);
+		emit(chunk, OpCode::OP_JumpIfTrue, loop);
+	}
+	else if (identifier == "if")
+	{
+		compileExpression(&arguments[0], chunk);
+		int skip = emit(chunk, OpCode::OP_JumpIfFalse);
+		compileInlineBlock(std::string(arguments[1].at(0).value), chunk, false);
+		chunk->code[skip].a = (int32_t)chunk->code.size();
+	}
+	else if (identifier == "ifelse")
+	{
+		compileExpression(&arguments[0], chunk);
+		int otherwise = emit(chunk, OpCode::OP_JumpIfFalse);
+		compileInlineBlock(std::string(arguments[1].at(0).value), chunk, false);
+		int done = emit(chunk, OpCode::OP_Jump);
+		chunk->code[otherwise].a = (int32_t)chunk->code.size();
+		compileInlineBlock(std::string(arguments[2].at(0).value), chunk, false);
+		chunk->code[done].a = (int32_t)chunk->code.size();
+	}
+	else if (identifier == "foreach")
+	{
+		for (int i = 0; i < 3; ++i)
+			compileExpression(&arguments[i], chunk);
+		int init = emit(chunk, OpCode::OP_IterInit);
+		int loop = emit(chunk, OpCode::OP_IterNext);
+		compileInlineBlock(std::string(arguments[3].at(0).value), chunk, false);
+		emit(chunk, OpCode::OP_Jump, loop);
+		chunk->code[init].a = (int32_t)chunk->code.size();
+		chunk->code[loop].a = (int32_t)chunk->code.size();
+	}
+
+	// what the builtin returns
+	emit(chunk, OpCode::OP_PushNull);
+	return true;
+}
+
+void Compiler::compileExpression(TokenList* list, Chunk* chunk, bool createIfNotExists)
+{
+	if (list->empty())
+	{
+		emit(chunk, OpCode::OP_PushNull);
+		return;
+	}
+
+	if (list->size() == 1)
+	{
+		compileImmediate(list->at(0), chunk, createIfNotExists);
+		return;
+	}
+
+	if (list->at(1).type == Token::TokenType::T_OpenSquareBracket) //must be an array index
+	{
+		bool foundMatchingSquareBracket = false;
+		TokenList subList;
+		for (size_t i = 2; i < list->size(); ++i)
+		{
+			if (list->at(i).type == Token::TokenType::T_CloseSquareBracket)
+			{
+				foundMatchingSquareBracket = true;
+				break;
+			}
+			subList.push_back(list->at(i));
+		}
+
+		if (!foundMatchingSquareBracket)
+		{
+			aaLang->error() << "Parse Error: square bracket mismatch, returning NULL" << std::endl;
+			emit(chunk, OpCode::OP_PushNull);
+			return;
+		}
+
+		compileExpression(&subList, chunk);
+		compileImmediate(list->at(0), chunk, createIfNotExists);
+		emit(chunk, OpCode::OP_Index, createIfNotExists);
+		return;
+	}
+
+	if (list->size() >= 3 && list->at(0).type == Token::TokenType::T_Identifier && list->at(1).type == Token::TokenType::T_OpenParenthesis)
+	{
+		std::string identifier(list->at(0).value);
+
+		std::vector<TokenList> arguments;
+		if (!splitCall(list, arguments))
+		{
+			aaLang->error() << "Parse Error: Parenthesis mismatch, returning NULL" << std::endl;
+			emit(chunk, OpCode::OP_PushNull);
+			return;
+		}
+
+		Variable folded;
+		if (foldConstant(list, folded))
+		{
+			emit(chunk, OpCode::OP_PushConst, addConstant(chunk, folded));
+			return;
+		}
+
+		// builtins can't be redefined from a script, so call() would always pick them first
+		auto native = aaLang->functions.find(identifier);
+		if (native == aaLang->functions.end())
+		{
+			for (auto& i : arguments)
+				compileExpression(&i, chunk);
+			int local = frameSlot(identifier);
+			if (local >= 0)
+				emit(chunk, OpCode::OP_CallLocal, local, (int32_t)arguments.size());
+			else
+				emit(chunk, OpCode::OP_CallBlock, aaLang->resolveGlobal(identifier), (int32_t)arguments.size());
+			return;
+		}
+
+		// the arity is checked here once, OP_CallNative calls the builtin as is
+		if (arguments.size() < (size_t)native->second->parameterCount)
+		{
+			aaLang->error() << "Parse Error: Too few arguments for call to " << identifier << "(), returning NULL" << std::endl;
+			emit(chunk, OpCode::OP_PushNull);
+			return;
+		}
+
+		if (lowered.count(native->second) && compileControlFlow(identifier, arguments, chunk))
+			return;
+
+		// a constant right operand of an inlined builtin is read from the constants, not pushed
+		auto op = inlined.find(native->second);
+		Variable right;
+		if (op != inlined.end() && arguments.size() == 2 && foldConstant(&arguments[1], right))
+		{
+			compileExpression(&arguments[0], chunk);
+			emit(chunk, op->second, addConstant(chunk, right), 1);
+			return;
+		}
+
+		for (auto& i : arguments)
+			compileExpression(&i, chunk);
+
+		if (op != inlined.end() && arguments.size() == 2)
+			emit(chunk, op->second);
+		else
+			emit(chunk, OpCode::OP_CallNative, native->second->index, (int32_t)arguments.size());
+		return;
+	}
+
+	emit(chunk, OpCode::OP_PushNull);
+}
+
+void Compiler::compileImmediate(Token& in, Chunk* chunk, bool createIfNotExists)
+{
+	if (in.type == Token::TokenType::T_Identifier)
+	{
+		emitLoad(chunk, std::string(in.value), createIfNotExists);
+	}
+	else if (in.type == Token::TokenType::T_Number || in.type == Token::TokenType::T_String)
+	{
+		emit(chunk, OpCode::OP_PushConst, addConstant(chunk, in.constant));
+	}
+	else if (in.type == Token::TokenType::T_Block)
+	{
+		// a block run right where it is written runs in this frame, like a lowered body
+		if (createIfNotExists)
+			compileInlineBlock(std::string(in.value), chunk, true);
+		else
+			emit(chunk, OpCode::OP_PushConst, addConstant(chunk, Variable::block(aaLang->blockCache.intern(std::string(in.value)))));
+	}
+	else
+	{
+		aaLang->error() << "Parse Error: Unexpected Token '" << in.value << " " << in.typeToString() << "'" << std::endl;
+		emit(chunk, OpCode::OP_PushNull);
+	}
+}
+
+// splits the arguments of "identifier ( ... )" on top level commas
+bool Compiler::splitCall(TokenList* list, std::vector<TokenList>& arguments)
+{
+	int parenthesisCount = 0;
+	TokenList subList;
+	for (size_t i = 2; i < list->size() - 1; ++i)
+	{
+		auto currentType = list->at(i).type;
+
+		if (currentType == Token::TokenType::T_OpenParenthesis)
+			parenthesisCount++;
+		else if (currentType == Token::TokenType::T_CloseParenthesis)
+			parenthesisCount--;
+
+		if (parenthesisCount == 0 && currentType == Token::TokenType::T_Comma)
+		{
+			arguments.push_back(subList);
+			subList.clear();
+		}
+		else
+		{
+			subList.push_back(list->at(i));
+		}
+	}
+	if (!subList.empty())
+		arguments.push_back(subList);
+
+	return parenthesisCount == 0;
+}
+
+// Evaluates literals and calls to pure builtins whose arguments are
+// themselves constant, e.g. add(1, mul(2, 3)).
+bool Compiler::foldConstant(TokenList* list, Variable& result)
+{
+	if (list->size() == 1)
+	{
+		Token& token = list->at(0);
+		if (token.type != Token::TokenType::T_Number && token.type != Token::TokenType::T_String)
+			return false;
+
+		result = token.constant;
+		return true;
+	}
+
+	if (list->size() < 3 || list->at(0).type != Token::TokenType::T_Identifier || list->at(1).type != Token::TokenType::T_OpenParenthesis)
+		return false;
+
+	auto native = aaLang->functions.find(std::string(list->at(0).value));
+	if (native == aaLang->functions.end() || !native->second->pure)
+		return false;
+
+	std::vector<TokenList> arguments;
+	if (!splitCall(list, arguments) || arguments.size() != (size_t)native->second->parameterCount)
+		return false;
+
+	std::vector<Variable> values(arguments.size());
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (!foldConstant(&arguments[i], values[i]))
+			return false;
+	}
+
+	CallStack callStack;
+	for (auto& i : values)
+		callStack.push(std::move(i));
+
+	result = native->second->execute(aaLang, &callStack, values.size());
+	return true;
+}
+
+int Compiler::emit(Chunk* chunk, OpCode op, int32_t a, int32_t b)
+{
+	chunk->code.push_back({ op, a, b });
+	return (int)chunk->code.size() - 1;
+}
+
+// the slot identifier has in the frame of the block being compiled, -1 for a global
+int Compiler::frameSlot(const std::string& identifier)
+{
+	if (!frame)
+		return -1;
+
+	auto found = std::find(frame->begin(), frame->end(), aaLang->resolveGlobal(identifier));
+	return found == frame->end() ? -1 : (int)(found - frame->begin());
+}
+
+int Compiler::emitLoad(Chunk* chunk, const std::string& identifier, bool createIfNotExists)
+{
+	int local = frameSlot(identifier);
+	if (local >= 0)
+		return emit(chunk, OpCode::OP_LoadLocal, local, createIfNotExists);
+
+	return emit(chunk, OpCode::OP_LoadVar, aaLang->resolveGlobal(identifier), createIfNotExists);
+}
+
+int Compiler::emitStore(Chunk* chunk, const std::string& identifier)
+{
+	int local = frameSlot(identifier);
+	if (local >= 0)
+		return emit(chunk, OpCode::OP_StoreLocal, local);
+
+	return emit(chunk, OpCode::OP_StoreVar, aaLang->resolveGlobal(identifier));
+}
+
+int Compiler::addConstant(Chunk* chunk, Variable constant)
+{
+	if (constant.type == Variable::VariableType::P_String)
+	{
+		if (strings.size() >= nextStringSweep)
+			sweepStrings();
+
+		std::string value(constant.string());
+		auto interned = strings.find(value);
+		if (interned == strings.end())
+			strings.emplace(value, constant);
+		else
+			constant = interned->second;
+	}
+
+	for (size_t i = 0; i < chunk->constants.size(); ++i)
+	{
+		Variable& existing = chunk->constants[i];
+		if (existing.type == constant.type && existing.iValue == constant.iValue)
+			return (int)i;
+	}
+
+	chunk->constants.push_back(std::move(constant));
+	return (int)chunk->constants.size() - 1;
+}
+
+void Compiler::sweepStrings()
+{
+	for (auto i = strings.begin(); i != strings.end();)
+	{
+		// only the table refers to it, the chunks that had it are gone
+		if (i->second.sValue->refCount == 1)
+			i = strings.erase(i);
+		else
+			++i;
+	}
+
+	nextStringSweep = std::max(minimumStringSweep, strings.size() * 2);
+}
+
+void Compiler::inlineNative(Function* native, OpCode op)
+{
+	inlined[native] = op;
+}
+
+void Compiler::lowerNative(Function* native)
+{
+	lowered.insert(native);
+}
+
+void Compiler::forgetNative(Function* native)
+{
+	inlined.erase(native);
+	lowered.erase(native);
+}
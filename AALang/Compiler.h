@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "Token.h"
+#include "Bytecode.h"
+
+struct AALang;
+class Function;
+
+class Compiler
+{
+public:
+	Compiler(AALang* aaLang);
+
+	Chunk* compileBlock(std::string block);
+	Chunk* compileLine(std::string line);
+
+	// the names a block keeps in its own frame: those it assigns to before
+	// reading them, itself or in the control flow bodies that run inline
+	void collectLocals(const std::string& block, std::vector<int>& locals);
+	// whether the call is lowered into jumps, literals[i] tells if argument i
+	// is a block literal. Those blocks then run in the caller's frame.
+	bool lowersCall(const std::string& identifier, const std::vector<bool>& literals);
+	void inlineNative(Function* native, OpCode op);
+	void lowerNative(Function* native);
+	// native is about to be deleted
+	void forgetNative(Function* native);
+
+private:
+	void compileStatement(TokenList* list, Chunk* chunk, bool endStatement = true);
+	void compileInlineBlock(std::string block, Chunk* chunk, bool keepValue);
+	bool compileControlFlow(const std::string& identifier, std::vector<TokenList>& arguments, Chunk* chunk);
+	void collectLocals(const std::string& block, std::vector<int>& locals, std::vector<int>& globals);
+	void collectReads(TokenList* list, std::vector<int>& locals, std::vector<int>& globals);
+	void compileExpression(TokenList* list, Chunk* chunk, bool createIfNotExists = false);
+	void compileImmediate(Token& in, Chunk* chunk, bool createIfNotExists);
+	bool splitCall(TokenList* list, std::vector<TokenList>& arguments);
+	bool readsFirst(TokenList* list, std::string_view identifier);
+	bool foldConstant(TokenList* list, Variable& result);
+
+	int emit(Chunk* chunk, OpCode op, int32_t a = 0, int32_t b = 0);
+	int emitLoad(Chunk* chunk, const std::string& identifier, bool createIfNotExists);
+	int emitStore(Chunk* chunk, const std::string& identifier);
+	int frameSlot(const std::string& identifier);
+	int addConstant(Chunk* chunk, Variable constant);
+
+	AALang* aaLang;
+	// the frame of the block being compiled, nullptr for a top level line
+	const std::vector<int>* frame;
+
+	// builtins with an opcode of their own, a redefinition is a new Function and is called normally
+	std::unordered_map<Function*, OpCode> inlined;
+	// while, if, ifelse and foreach, compiled to jumps around their blocks when those are literals
+	std::unordered_set<Function*> lowered;
+
+	// the string literals of the chunks compiled so far, they share one
+	// immutable copy. Literals no chunk holds any more are swept out once
+	// the table doubled since the last sweep.
+	std::unordered_map<std::string, Variable> strings;
+	size_t nextStringSweep;
+	void sweepStrings();
+};
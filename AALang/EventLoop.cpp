@@ -0,0 +1,348 @@
+#include "EventLoop.h"
+#include <fstream>
+#include <sstream>
+#include <array>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+#ifdef __linux__
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+extern char** environ;
+#endif
+
+// whole file into result, false if it can't be opened
+static bool readFile(const std::string& path, std::string& result)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	result = contents.str();
+	return true;
+}
+
+#ifndef _WIN32
+// what a shell puts in $?, the exit code or 128 + the signal that killed it
+static int exitStatus(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return -1;
+}
+#endif
+
+#ifndef __linux__
+
+static FILE* openCommand(const std::string& command)
+{
+#ifdef _WIN32
+	return _popen(command.c_str(), "r");
+#else
+	return popen(command.c_str(), "r");
+#endif
+}
+
+// the command's exit status
+static int closeCommand(FILE* pipe)
+{
+#ifdef _WIN32
+	return _pclose(pipe);
+#else
+	int status = pclose(pipe);
+	return status < 0 ? -1 : exitStatus(status);
+#endif
+}
+
+EventLoop::EventLoop()
+	:lastStatus(-1), nextHandle(1)
+{
+}
+
+EventLoop::~EventLoop()
+{
+	for (auto& i : operations)
+		finish(*i.second);
+}
+
+int64_t EventLoop::startCommand(const std::string& command)
+{
+	auto operation = std::make_unique<Operation>();
+	operation->command = true;
+	Operation* target = operation.get();
+	operation->worker = std::thread([target, command]() {
+		FILE* pipe = openCommand(command);
+		if (!pipe)
+		{
+			target->failed = true;
+			return;
+		}
+
+		std::array<char, 4096> buffer;
+		size_t read;
+		while ((read = fread(buffer.data(), 1, buffer.size(), pipe)) > 0)
+			target->output.append(buffer.data(), read);
+		target->status = closeCommand(pipe);
+	});
+	return add(std::move(operation));
+}
+
+int64_t EventLoop::startRead(const std::string& path)
+{
+	auto operation = std::make_unique<Operation>();
+	Operation* target = operation.get();
+	operation->worker = std::thread([target, path]() {
+		target->failed = !readFile(path, target->output);
+	});
+	return add(std::move(operation));
+}
+
+void EventLoop::finish(Operation& operation)
+{
+	if (operation.worker.joinable())
+		operation.worker.join();
+	operation.done = true;
+}
+
+bool EventLoop::await(int64_t handle, std::string& result)
+{
+	auto found = operations.find(handle);
+	if (found == operations.end())
+		return false;
+
+	Operation& operation = *found->second;
+	finish(operation);
+	if (operation.command)
+		lastStatus = operation.status;
+	bool failed = operation.failed;
+	result = std::move(operation.output);
+	operations.erase(found);
+	return !failed;
+}
+
+#else
+
+EventLoop::EventLoop()
+	:lastStatus(-1), nextHandle(1), epoll(epoll_create1(EPOLL_CLOEXEC))
+{
+	if (epoll < 0)
+		failure = std::string("epoll_create1: ") + strerror(errno);
+}
+
+EventLoop::~EventLoop()
+{
+	for (auto& i : operations)
+		finish(*i.second);
+	if (epoll >= 0)
+		close(epoll);
+}
+
+int64_t EventLoop::startCommand(const std::string& command)
+{
+	if (epoll < 0)
+		return -1;
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		return -1;
+
+	// the child only keeps the write end, as its stdout
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+	std::string shell = "sh";
+	std::string flag = "-c";
+	std::string line = command;
+	char* argv[] = { &shell[0], &flag[0], &line[0], nullptr };
+
+	pid_t pid;
+	int spawned = posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (spawned != 0)
+	{
+		close(fds[0]);
+		return -1;
+	}
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	auto operation = std::make_unique<Operation>();
+	operation->command = true;
+	operation->fd = fds[0];
+	operation->pid = pid;
+	Operation* target = operation.get();
+	int64_t handle = add(std::move(operation));
+	watch(handle, *target);
+	return handle;
+}
+
+int64_t EventLoop::startRead(const std::string& path)
+{
+	if (epoll < 0)
+		return -1;
+
+	auto operation = std::make_unique<Operation>();
+	operation->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (operation->fd < 0)
+		return -1;
+
+	Operation* target = operation.get();
+	int signal = operation->fd;
+	operation->worker = std::thread([target, path, signal]() {
+		target->failed = !readFile(path, target->output);
+		uint64_t one = 1;
+		ssize_t written = write(signal, &one, sizeof(one));
+		(void)written;
+	});
+
+	int64_t handle = add(std::move(operation));
+	watch(handle, *target);
+	return handle;
+}
+
+// an operation epoll doesn't report would be waited on forever, it fails
+// right away instead
+void EventLoop::watch(int64_t handle, Operation& operation)
+{
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.u64 = (uint64_t)handle;
+	if (epoll_ctl(epoll, EPOLL_CTL_ADD, operation.fd, &event) != 0)
+	{
+		failure = std::string("epoll_ctl: ") + strerror(errno);
+		operation.failed = true;
+		finish(operation);
+	}
+}
+
+// the loop can't wait any more, every pending operation fails instead
+void EventLoop::fail(const std::string& reason)
+{
+	failure = reason;
+	for (auto& i : operations)
+	{
+		if (!i.second->done)
+		{
+			i.second->failed = true;
+			finish(*i.second);
+		}
+	}
+}
+
+// drains a command's pipe, at the end of its output the child is reaped
+void EventLoop::readPipe(Operation& operation)
+{
+	std::array<char, 65536> buffer;
+	while (true)
+	{
+		ssize_t read = ::read(operation.fd, buffer.data(), buffer.size());
+		if (read > 0)
+		{
+			operation.output.append(buffer.data(), (size_t)read);
+			continue;
+		}
+		if (read < 0 && errno == EINTR)
+			continue;
+		if (read < 0 && errno == EAGAIN)
+			return;
+
+		finish(operation);
+		return;
+	}
+}
+
+void EventLoop::finish(Operation& operation)
+{
+	if (operation.done)
+		return;
+
+	if (operation.fd >= 0)
+	{
+		epoll_ctl(epoll, EPOLL_CTL_DEL, operation.fd, nullptr);
+		close(operation.fd);
+		operation.fd = -1;
+	}
+	if (operation.pid > 0)
+	{
+		int status;
+		pid_t reaped;
+		while ((reaped = waitpid(operation.pid, &status, 0)) < 0 && errno == EINTR)
+		{
+		}
+		if (reaped == operation.pid)
+			operation.status = exitStatus(status);
+		operation.pid = -1;
+	}
+	if (operation.worker.joinable())
+		operation.worker.join();
+	operation.done = true;
+}
+
+// one round of the loop, reads whatever is ready
+void EventLoop::wait()
+{
+	std::array<epoll_event, 64> events;
+	int ready = epoll_wait(epoll, events.data(), (int)events.size(), -1);
+	if (ready < 0)
+	{
+		if (errno != EINTR)
+			fail(std::string("epoll_wait: ") + strerror(errno));
+		return;
+	}
+
+	for (int i = 0; i < ready; i++)
+	{
+		auto found = operations.find((int64_t)events[i].data.u64);
+		if (found == operations.end())
+			continue;
+
+		Operation& operation = *found->second;
+		if (operation.pid > 0)
+			readPipe(operation);
+		else
+			finish(operation);
+	}
+}
+
+bool EventLoop::await(int64_t handle, std::string& result)
+{
+	auto found = operations.find(handle);
+	if (found == operations.end())
+		return false;
+
+	Operation& operation = *found->second;
+	while (!operation.done)
+		wait();
+
+	if (operation.command)
+		lastStatus = operation.status;
+	bool failed = operation.failed;
+	result = std::move(operation.output);
+	operations.erase(found);
+	return !failed;
+}
+
+#endif
+
+int64_t EventLoop::add(std::unique_ptr<Operation> operation)
+{
+	int64_t handle = nextHandle++;
+	operations.emplace(handle, std::move(operation));
+	return handle;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+// Commands and file reads started by cmdAsync() and readFileAsync(). Each
+// one is known by a handle number. On Linux a command's output pipe is
+// watched by epoll and read whenever any await() runs, so all running
+// commands make progress while the script waits on one of them. Files,
+// which epoll can't wait on, are read on a thread that signals the loop
+// through an eventfd. Elsewhere every operation runs on its own thread
+// through popen().
+class EventLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	// the command runs through the shell, -1 if it couldn't be started
+	int64_t startCommand(const std::string& command);
+	int64_t startRead(const std::string& path);
+
+	// waits for the operation and forgets it. False for an unknown handle,
+	// a file that couldn't be read or a loop that stopped working.
+	bool await(int64_t handle, std::string& result);
+
+	// exit status of the last command await() finished, 128 + the signal
+	// for one that was killed, -1 while none has
+	int lastStatus;
+	// why the loop can't run operations, empty while it can
+	std::string failure;
+
+private:
+	struct Operation
+	{
+		std::string output;
+		bool done = false;
+		bool failed = false;
+		int fd = -1;
+		int pid = -1;
+		bool command = false;
+		int status = -1;
+		std::thread worker;
+	};
+
+	int64_t add(std::unique_ptr<Operation> operation);
+	void finish(Operation& operation);
+
+	std::unordered_map<int64_t, std::unique_ptr<Operation>> operations;
+	int64_t nextHandle;
+
+#ifdef __linux__
+	void readPipe(Operation& operation);
+	void watch(int64_t handle, Operation& operation);
+	void wait();
+	void fail(const std::string& reason);
+
+	int epoll;
+#endif
+};
@@ -0,0 +1,193 @@
+#include "Files.h"
+#include "Variable.h"
+#include <cstring>
+#include <algorithm>
+
+// the buffer a file that can't be mapped is read through, it only grows
+// for a line that doesn't fit
+static const size_t readBufferSize = 1024 * 1024;
+
+Files::Files()
+	:nextHandle(1)
+{
+}
+
+int64_t Files::open(const std::string& path, const std::string& mode)
+{
+	auto file = std::make_unique<File>();
+
+	if (mode == "r")
+	{
+		file->mapping = std::make_shared<MappedFile>(path);
+		if (file->mapping->isOpen())
+		{
+			file->mapping->adviseSequential();
+		}
+		else
+		{
+			file->mapping.reset();
+			file->stream.open(path, std::ios::in | std::ios::binary);
+			if (!file->stream)
+				return -1;
+			file->buffer.resize(readBufferSize);
+		}
+	}
+	else if (mode == "w" || mode == "a")
+	{
+		file->output = std::make_unique<Output>();
+		if (!file->output->redirect(path, mode == "a"))
+			return -1;
+	}
+	else
+	{
+		return -1;
+	}
+
+	int64_t handle = nextHandle++;
+	files.emplace(handle, std::move(file));
+	return handle;
+}
+
+bool Files::close(int64_t handle)
+{
+	auto found = files.find(handle);
+	if (found == files.end())
+		return false;
+
+	// lines read from a mapping keep it alive on their own
+	if (found->second->output)
+		found->second->output->flush();
+	files.erase(found);
+	return true;
+}
+
+Files::File* Files::reader(int64_t handle)
+{
+	auto found = files.find(handle);
+	if (found == files.end() || found->second->output)
+		return nullptr;
+	return found->second.get();
+}
+
+Output* Files::writer(int64_t handle)
+{
+	auto found = files.find(handle);
+	if (found == files.end())
+		return nullptr;
+	return found->second->output.get();
+}
+
+// moves what is left to the front of the buffer and reads more behind it,
+// false once the stream has nothing more
+bool Files::fill(File& file)
+{
+	if (file.drained)
+		return false;
+
+	if (file.begin > 0)
+	{
+		std::memmove(file.buffer.data(), file.buffer.data() + file.begin, file.end - file.begin);
+		file.end -= file.begin;
+		file.begin = 0;
+	}
+	if (file.end == file.buffer.size())
+		file.buffer.resize(file.buffer.size() * 2);
+
+	file.stream.read(file.buffer.data() + file.end, file.buffer.size() - file.end);
+	size_t read = (size_t)file.stream.gcount();
+	file.end += read;
+	if (read == 0)
+		file.drained = true;
+	return read > 0;
+}
+
+bool Files::readLine(int64_t handle, Variable& line)
+{
+	File* file = reader(handle);
+	if (!file)
+		return false;
+
+	if (file->mapping)
+	{
+		std::string_view data = file->mapping->view();
+		if (file->position >= data.size())
+			return false;
+
+		size_t next = data.find('\n', file->position);
+		size_t stop = next == std::string_view::npos ? data.size() : next;
+		size_t length = stop - file->position;
+		if (length > 0 && data[stop - 1] == '\r')
+			length--;
+
+		line = Variable::mapped(file->mapping, file->position, length);
+		file->position = next == std::string_view::npos ? data.size() : next + 1;
+		return true;
+	}
+
+	size_t searched = file->begin;
+	while (true)
+	{
+		const char* first = file->buffer.data() + file->begin;
+		const char* next = (const char*)std::memchr(file->buffer.data() + searched, '\n', file->end - searched);
+		if (next || (file->drained && file->begin < file->end))
+		{
+			size_t length = next ? next - first : file->end - file->begin;
+			file->begin += next ? length + 1 : length;
+			if (length > 0 && first[length - 1] == '\r')
+				length--;
+
+			line = Variable(std::string(first, length));
+			return true;
+		}
+
+		// only what was read since needs looking at again
+		searched = file->end - file->begin;
+		if (!fill(*file) && file->begin == file->end)
+			return false;
+		searched += file->begin;
+	}
+}
+
+bool Files::readChunk(int64_t handle, size_t size, Variable& chunk)
+{
+	File* file = reader(handle);
+	if (!file || size == 0)
+		return false;
+
+	if (file->mapping)
+	{
+		size_t available = file->mapping->view().size() - std::min(file->position, file->mapping->view().size());
+		if (available == 0)
+			return false;
+
+		size_t length = std::min(size, available);
+		chunk = Variable::mapped(file->mapping, file->position, length);
+		file->position += length;
+		return true;
+	}
+
+	while (file->end - file->begin < size && fill(*file))
+	{
+	}
+	if (file->begin == file->end)
+		return false;
+
+	size_t length = std::min(size, file->end - file->begin);
+	chunk = Variable(std::string(file->buffer.data() + file->begin, length));
+	file->begin += length;
+	return true;
+}
+
+bool Files::atEnd(int64_t handle)
+{
+	File* file = reader(handle);
+	if (!file)
+		return true;
+
+	if (file->mapping)
+		return file->position >= file->mapping->view().size();
+
+	if (file->begin < file->end)
+		return false;
+	return !fill(*file);
+}
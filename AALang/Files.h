@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <unordered_map>
+
+#include "MappedFile.h"
+#include "Output.h"
+
+class Variable;
+
+// Files opened by openFile(), known by a handle number. A file that is read
+// is mapped when it can be, then every line or chunk is a string pointing
+// into the mapping and nothing is copied. Pipes and other files that can't
+// be mapped are read through one buffer that is reused for every line. A
+// file that is written collects its output in a buffer like print() does.
+class Files
+{
+public:
+	Files();
+
+	Files(const Files&) = delete;
+	Files& operator=(const Files&) = delete;
+
+	// mode is "r", "w" or "a", -1 if the file can't be opened
+	int64_t open(const std::string& path, const std::string& mode);
+	bool close(int64_t handle);
+
+	// the next line without its line break, false at the end of the file or
+	// for a handle that isn't open for reading
+	bool readLine(int64_t handle, Variable& line);
+	// up to size bytes, false the same way
+	bool readChunk(int64_t handle, size_t size, Variable& chunk);
+	// true once everything has been read, or for an unknown handle
+	bool atEnd(int64_t handle);
+
+	// nullptr for a handle that isn't open for writing
+	Output* writer(int64_t handle);
+
+private:
+	struct File
+	{
+		// reading a mapped file
+		std::shared_ptr<MappedFile> mapping;
+		size_t position = 0;
+
+		// reading anything else
+		std::ifstream stream;
+		std::vector<char> buffer;
+		size_t begin = 0;
+		size_t end = 0;
+		bool drained = false;
+
+		// writing
+		std::unique_ptr<Output> output;
+	};
+
+	File* reader(int64_t handle);
+	bool fill(File& file);
+
+	std::unordered_map<int64_t, std::unique_ptr<File>> files;
+	int64_t nextHandle;
+};
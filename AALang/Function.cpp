@@ -1,22 +1,24 @@
 #include <iostream>
 #include "Function.h"
 #include "CallStack.h"
+#include "AALang.h"
 
-Function::Function(std::string identifier, int parameterCount, Action action)
-	:identifier(identifier), parameterCount(parameterCount), action(action)
+Function::Function(std::string identifier, int parameterCount, Action action, bool pure)
+	:identifier(identifier), parameterCount(parameterCount), action(action), pure(pure), index(-1)
 {
 }
 
-std::shared_ptr<Variable> Function::execute(CallStack* p)
+Variable Function::execute(AALang* aaLang, CallStack* stack, size_t count)
 {
-	if (p->size() >= parameterCount)
+	Arguments args{ stack, stack->size() - count, count };
+	if (count < (size_t)parameterCount)
 	{
-		return action(p);
-	}
-	else
-	{
-		std::cout << "Runtime Error: Call to " << identifier << "() failed. Too few stack items for call. returning nullptr from Function::execute()." << std::endl;
+		aaLang->error() << "Runtime Error: Call to " << identifier << "() failed. Too few arguments for call. returning NULL from Function::execute()." << std::endl;
+		stack->truncate(args.base);
+		return Variable();
 	}
 
-	return nullptr;
+	Variable result = action(aaLang, args);
+	stack->truncate(args.base);
+	return result;
 }
\ No newline at end of file
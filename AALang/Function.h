@@ -1,20 +1,28 @@
 #pragma once
 
 #include <string>
-#include <functional>
+#include "Variable.h"
+#include "CallStack.h"
 
-class Variable;
-class CallStack;
+struct AALang;
 
-typedef std::function<std::shared_ptr<Variable> (CallStack*)> Action;
+// a plain function pointer, the interpreter is passed in instead of captured
+typedef Variable (*Action)(AALang* aaLang, Arguments& args);
 
 class Function
 {
 public:
-	Function(std::string identifier, int parameterCount, Action action);
-	std::shared_ptr<Variable> execute(CallStack* p);
+	Function(std::string identifier, int parameterCount, Action action, bool pure = false);
+	// runs the action on the top count entries of the stack and drops them
+	Variable execute(AALang* aaLang, CallStack* stack, size_t count);
 
 	std::string identifier;
 	int parameterCount;
 	Action action;
+
+	// only depends on its arguments, calls with constant arguments are folded by the compiler
+	bool pure;
+
+	// position in AALang::natives, compiled calls refer to it by this
+	int index;
 };
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include "Heap.h"
+#include "Variable.h"
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+static thread_local Heap* currentHeap = nullptr;
+
+static const size_t minimumCollection = 1024;
+
+Heap::Heap()
+{
+	liveStrings = 0;
+	liveMaps = 0;
+	liveBlocks = 0;
+	liveBytes = 0;
+	arenaBytes = 0;
+	allocations = 0;
+	collections = 0;
+	collected = 0;
+
+	lastAllocations = 0;
+	lastSample = std::chrono::high_resolution_clock::now();
+
+	for (size_t i = 0; i < sizeClasses; i++)
+		freeLists[i] = nullptr;
+	slabCursor = nullptr;
+	slabEnd = nullptr;
+
+	maps = nullptr;
+	nextCollection = minimumCollection;
+}
+
+Heap::~Heap()
+{
+	collectCycles();
+
+	for (char* slab : slabs)
+		std::free(slab);
+
+	if (currentHeap == this)
+		currentHeap = nullptr;
+}
+
+void* Heap::allocate(size_t size)
+{
+	allocations++;
+	liveBlocks++;
+
+	if (size > granularity * sizeClasses)
+	{
+		liveBytes += size;
+		return std::malloc(size);
+	}
+
+	size_t sizeClass = size == 0 ? 0 : (size - 1) / granularity;
+	size_t blockSize = (sizeClass + 1) * granularity;
+	liveBytes += blockSize;
+
+	FreeBlock* block = freeLists[sizeClass];
+	if (block)
+	{
+		freeLists[sizeClass] = block->next;
+		return block;
+	}
+
+	if (slabCursor + blockSize > slabEnd)
+	{
+		slabCursor = (char*)std::malloc(slabSize);
+		if (!slabCursor)
+			throw std::bad_alloc();
+		slabEnd = slabCursor + slabSize;
+		slabs.push_back(slabCursor);
+		arenaBytes += slabSize;
+	}
+
+	void* p = slabCursor;
+	slabCursor += blockSize;
+	return p;
+}
+
+void Heap::deallocate(void* p, size_t size)
+{
+	liveBlocks--;
+
+	if (size > granularity * sizeClasses)
+	{
+		liveBytes -= size;
+		std::free(p);
+		return;
+	}
+
+	size_t sizeClass = size == 0 ? 0 : (size - 1) / granularity;
+	liveBytes -= (sizeClass + 1) * granularity;
+
+	FreeBlock* block = (FreeBlock*)p;
+	block->next = freeLists[sizeClass];
+	freeLists[sizeClass] = block;
+}
+
+StringObject* Heap::newString(const std::string& value)
+{
+	liveStrings++;
+	return new (allocate(sizeof(StringObject))) StringObject{ 1, this, value, nullptr, nullptr, nullptr, value.size(), 0 };
+}
+
+StringObject* Heap::newConcat(StringObject* left, StringObject* right)
+{
+	liveStrings++;
+	left->refCount++;
+	right->refCount++;
+	return new (allocate(sizeof(StringObject))) StringObject{ 1, this, std::string(), nullptr, left, right, left->length + right->length, 0 };
+}
+
+MapObject* Heap::newMap()
+{
+	if (liveMaps >= nextCollection)
+	{
+		collectCycles();
+		nextCollection = std::max(minimumCollection, liveMaps * 2);
+	}
+
+	MapObject* m = new (allocate(sizeof(MapObject))) MapObject(this);
+	m->next = maps;
+	if (maps)
+		maps->prev = m;
+	maps = m;
+
+	liveMaps++;
+	return m;
+}
+
+void Heap::releaseString(StringObject* s)
+{
+	if (--s->refCount > 0)
+		return;
+
+	if (!s->left)
+	{
+		liveStrings--;
+		s->~StringObject();
+		deallocate(s, sizeof(StringObject));
+		return;
+	}
+
+	// without recursing, a rope can be as deep as the loop that built it.
+	// Its pieces may come from the heap of another interpreter.
+	std::vector<StringObject*> pending(1, s);
+	while (!pending.empty())
+	{
+		StringObject* p = pending.back();
+		pending.pop_back();
+
+		if (p->left && --p->left->refCount == 0)
+			pending.push_back(p->left);
+		if (p->right && --p->right->refCount == 0)
+			pending.push_back(p->right);
+
+		Heap* owner = p->heap;
+		owner->liveStrings--;
+		p->~StringObject();
+		owner->deallocate(p, sizeof(StringObject));
+	}
+}
+
+void Heap::freeMap(MapObject* m)
+{
+	if (m->prev)
+		m->prev->next = m->next;
+	else
+		maps = m->next;
+	if (m->next)
+		m->next->prev = m->prev;
+
+	liveMaps--;
+	m->~MapObject();
+	deallocate(m, sizeof(MapObject));
+}
+
+void Heap::markBlocks(std::vector<bool>& live)
+{
+	for (MapObject* m = maps; m; m = m->next)
+	{
+		for (auto& it : m->values)
+		{
+			Variable& v = it.value();
+			if (v.type == Variable::VariableType::P_Block)
+				live[v.blockId] = true;
+		}
+	}
+}
+
+// Trial deletion: subtract every reference a map receives from another map
+// in this heap. Whatever is left over comes from outside (globals, stacks,
+// constants), those maps and everything they reach stay, the rest can only
+// be kept alive by cycles.
+size_t Heap::collectCycles()
+{
+	collections++;
+
+	for (MapObject* m = maps; m; m = m->next)
+		m->gcRefs = m->refCount;
+
+	for (MapObject* m = maps; m; m = m->next)
+	{
+		for (auto& it : m->values)
+		{
+			Variable& v = it.value();
+			if (v.type == Variable::VariableType::P_Map && v.mValue->heap == this)
+				v.mValue->gcRefs--;
+		}
+	}
+
+	std::vector<MapObject*> pending;
+	for (MapObject* m = maps; m; m = m->next)
+	{
+		if (m->gcRefs > 0)
+			pending.push_back(m);
+	}
+
+	while (!pending.empty())
+	{
+		MapObject* m = pending.back();
+		pending.pop_back();
+
+		if (m->gcRefs == -1)
+			continue;
+		m->gcRefs = -1;
+
+		for (auto& it : m->values)
+		{
+			Variable& v = it.value();
+			if (v.type == Variable::VariableType::P_Map && v.mValue->heap == this && v.mValue->gcRefs != -1)
+				pending.push_back(v.mValue);
+		}
+	}
+
+	std::vector<MapObject*> garbage;
+	for (MapObject* m = maps; m; m = m->next)
+	{
+		if (m->gcRefs != -1)
+			garbage.push_back(m);
+	}
+
+	// hold on to every garbage map while the cycles are broken so none of
+	// them is freed while another one is still being cleared
+	for (MapObject* m : garbage)
+		m->refCount++;
+	for (MapObject* m : garbage)
+		m->values.clear();
+	for (MapObject* m : garbage)
+	{
+		if (--m->refCount == 0)
+			freeMap(m);
+	}
+
+	collected += garbage.size();
+	return garbage.size();
+}
+
+Heap* Heap::current()
+{
+	if (currentHeap)
+		return currentHeap;
+
+	// objects created outside of any interpreter
+	static thread_local Heap fallback;
+	return &fallback;
+}
+
+void Heap::setCurrent(Heap* heap)
+{
+	currentHeap = heap;
+}
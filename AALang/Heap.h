@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <chrono>
+
+struct StringObject;
+struct MapObject;
+
+// Per-interpreter arena for everything a Variable points at. Small blocks
+// come from size-class free lists carved out of large slabs, bigger ones go
+// straight to malloc. Strings and maps are refcounted, maps are additionally
+// linked into a list so collectCycles() can find the ones that only keep
+// each other alive.
+class Heap
+{
+public:
+	Heap();
+	~Heap();
+
+	void* allocate(size_t size);
+	void deallocate(void* p, size_t size);
+
+	StringObject* newString(const std::string& value);
+	StringObject* newConcat(StringObject* left, StringObject* right);
+	MapObject* newMap();
+	// drops one reference, the pieces of a rope are released along with it
+	void releaseString(StringObject* s);
+	void freeMap(MapObject* m);
+
+	size_t collectCycles();
+	// sets live[blockId] for every block a map holds
+	void markBlocks(std::vector<bool>& live);
+
+	// Variables don't know which interpreter they belong to, new objects are
+	// taken from the heap of the interpreter running on this thread
+	static Heap* current();
+	static void setCurrent(Heap* heap);
+
+	size_t liveStrings;
+	size_t liveMaps;
+	size_t liveBlocks;
+	size_t liveBytes;
+	size_t arenaBytes;
+	size_t allocations;
+	size_t collections;
+	size_t collected;
+
+	size_t lastAllocations;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastSample;
+
+private:
+	static const size_t granularity = 16;
+	static const size_t sizeClasses = 16;
+	static const size_t slabSize = 64 * 1024;
+
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	FreeBlock* freeLists[sizeClasses];
+	std::vector<char*> slabs;
+	char* slabCursor;
+	char* slabEnd;
+
+	MapObject* maps;
+	size_t nextCollection;
+};
+
+// Makes the node containers inside StringObject/MapObject allocate from the
+// heap that owns them.
+template <typename T>
+struct PoolAllocator
+{
+	typedef T value_type;
+
+	PoolAllocator(Heap* heap)
+		:heap(heap)
+	{
+	}
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U>& other)
+		:heap(other.heap)
+	{
+	}
+
+	T* allocate(size_t n)
+	{
+		return (T*)heap->allocate(n * sizeof(T));
+	}
+	void deallocate(T* p, size_t n)
+	{
+		heap->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const PoolAllocator<U>& other) const
+	{
+		return heap == other.heap;
+	}
+	template <typename U>
+	bool operator!=(const PoolAllocator<U>& other) const
+	{
+		return heap != other.heap;
+	}
+
+	Heap* heap;
+};
+
+// Installs a heap as current for the lifetime of the scope.
+class HeapScope
+{
+public:
+	HeapScope(Heap* heap)
+		:previous(Heap::current())
+	{
+		Heap::setCurrent(heap);
+	}
+	~HeapScope()
+	{
+		Heap::setCurrent(previous);
+	}
+
+private:
+	Heap* previous;
+};
@@ -0,0 +1,36 @@
+#include "Interpreters.h"
+#include "AALang.h"
+#include <thread>
+#include <vector>
+#include <exception>
+
+void runInterpreters(size_t count, const std::function<void(AALang& aaLang, size_t index)>& job)
+{
+	std::vector<std::exception_ptr> errors(count);
+	std::vector<std::thread> threads;
+	threads.reserve(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		threads.emplace_back([&job, &errors, i]() {
+			try
+			{
+				AALang aaLang;
+				job(aaLang, i);
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	for (std::exception_ptr& error : errors)
+	{
+		if (error)
+			std::rethrow_exception(error);
+	}
+}
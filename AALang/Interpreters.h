@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+struct AALang;
+
+// Runs job on count threads, each with its own AALang that lives for the
+// call. Interpreters share nothing, a CompiledScript made up front can be
+// loaded by all of them. Returns once every job is done and rethrows the
+// first exception one of them threw.
+void runInterpreters(size_t count, const std::function<void(AALang& aaLang, size_t index)>& job);
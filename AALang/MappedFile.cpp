@@ -0,0 +1,114 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+	:data(nullptr), size(0), open(false), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+		return;
+
+	size = (size_t)fileSize.QuadPart;
+	open = true;
+
+	// empty files can't be mapped, they are just an empty view
+	if (size == 0)
+		return;
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		open = false;
+		return;
+	}
+
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+		open = false;
+}
+
+void MappedFile::adviseSequential()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+	:data(nullptr), size(0), open(false)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+	{
+		size = (size_t)info.st_size;
+		open = true;
+
+		// empty files can't be mapped, they are just an empty view
+		if (size > 0)
+		{
+			void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED)
+				open = false;
+			else
+				data = (const char*)p;
+		}
+	}
+
+	// the mapping keeps the file alive on its own
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		munmap((void*)data, size);
+}
+
+void MappedFile::adviseSequential()
+{
+	if (data)
+		madvise((void*)data, size, MADV_SEQUENTIAL);
+}
+
+#endif
+
+bool MappedFile::isOpen() const
+{
+	return open;
+}
+
+std::string_view MappedFile::view() const
+{
+	if (!open)
+		return std::string_view();
+
+	return std::string_view(data, size);
+}
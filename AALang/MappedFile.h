@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string_view>
+#include <filesystem>
+
+// A whole file mapped read-only into memory. Scripts are preparsed straight
+// from the mapping and getFileContents hands it to scripts as a string, so
+// neither is ever copied into a buffer first.
+class MappedFile
+{
+public:
+	MappedFile(const std::filesystem::path& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const;
+	std::string_view view() const;
+
+	// read front to back once, the OS can read ahead and drop what's behind
+	void adviseSequential();
+
+private:
+	const char* data;
+	size_t size;
+	bool open;
+
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+};
@@ -0,0 +1,136 @@
+#include "Output.h"
+#include "Variable.h"
+#include <iostream>
+#include <charconv>
+#include <cstring>
+
+static const size_t defaultBufferSize = 64 * 1024;
+
+// enough for any int64 and for a double printed like std::to_string does
+static const size_t numberSize = 512;
+
+Output::Output()
+	:used(0), bufferSize(defaultBufferSize), stream(&std::cout), captured(nullptr)
+{
+	buffer.resize(bufferSize);
+}
+
+Output::~Output()
+{
+	flush();
+}
+
+void Output::write(std::string_view text)
+{
+	if (used + text.size() > bufferSize)
+	{
+		writeBuffer();
+
+		// too large to be worth copying
+		if (text.size() >= bufferSize)
+		{
+			stream->write(text.data(), text.size());
+			return;
+		}
+	}
+
+	std::memcpy(buffer.data() + used, text.data(), text.size());
+	used += text.size();
+}
+
+// space for size bytes at the end of the buffer, which may grow past
+// bufferSize for one number
+char* Output::reserve(size_t size)
+{
+	if (used + size > bufferSize)
+		writeBuffer();
+	if (buffer.size() < used + size)
+		buffer.resize(used + size);
+	return buffer.data() + used;
+}
+
+void Output::write(Variable& value)
+{
+	Variable& v = value.deref();
+	switch (v.type)
+	{
+	case Variable::VariableType::P_String:
+		write(v.string());
+		break;
+	case Variable::VariableType::P_Int:
+	{
+		char* first = reserve(numberSize);
+		used += std::to_chars(first, first + numberSize, v.iValue).ptr - first;
+		break;
+	}
+	case Variable::VariableType::P_Double:
+	{
+		// six decimals like Variable::toString
+		char* first = reserve(numberSize);
+		used += std::to_chars(first, first + numberSize, v.dValue, std::chars_format::fixed, 6).ptr - first;
+		break;
+	}
+	default:
+		write(v.toString());
+		break;
+	}
+
+	// a number reserved past the end of a small buffer
+	if (used > bufferSize)
+		writeBuffer();
+}
+
+void Output::writeBuffer()
+{
+	if (used > 0)
+		stream->write(buffer.data(), used);
+	used = 0;
+}
+
+void Output::flush()
+{
+	writeBuffer();
+	stream->flush();
+}
+
+void Output::setBufferSize(size_t size)
+{
+	flush();
+	bufferSize = size;
+	buffer.resize(size);
+}
+
+bool Output::redirect(const std::string& path, bool append)
+{
+	flush();
+	if (file.is_open())
+		file.close();
+	// a capture keeps the text until it ends
+	stream = captured ? captured : &std::cout;
+
+	if (path.empty())
+		return true;
+
+	file.open(path, std::ios::out | std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+	if (!file)
+		return false;
+
+	if (!captured)
+		stream = &file;
+	return true;
+}
+
+void Output::capture(std::ostream* into)
+{
+	flush();
+	captured = into;
+	if (into)
+		stream = into;
+	else
+		stream = file.is_open() ? static_cast<std::ostream*>(&file) : &std::cout;
+}
+
+std::ostream& Output::errorStream()
+{
+	return captured ? *captured : std::cout;
+}
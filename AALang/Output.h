@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+
+class Variable;
+
+// Where print() writes to. Text collects in a buffer that goes out in one
+// write when it is full or flush() is called, the host flushes before it
+// writes to the console itself. Numbers are formatted straight into the
+// buffer.
+class Output
+{
+public:
+	Output();
+	~Output();
+
+	void write(std::string_view text);
+	void write(Variable& value);
+	void flush();
+
+	// 0 writes every print() through at once
+	void setBufferSize(size_t size);
+	// an empty path goes back to std::cout
+	bool redirect(const std::string& path, bool append = false);
+	// text goes to into instead until it is called with nullptr, errors too
+	void capture(std::ostream* into);
+	// where errors are written, std::cout unless captured
+	std::ostream& errorStream();
+
+private:
+	char* reserve(size_t size);
+	void writeBuffer();
+
+	std::vector<char> buffer;
+	size_t used;
+	size_t bufferSize;
+
+	std::ostream* stream;
+	std::ostream* captured;
+	std::ofstream file;
+};
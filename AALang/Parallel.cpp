@@ -0,0 +1,458 @@
+#include "Parallel.h"
+#include "AALang.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <unordered_set>
+
+// items are split into at most this many chunks whatever the thread count,
+// so a reduction adds up in the same order on any machine
+static const size_t maxChunks = 256;
+
+SharedValue::SharedValue()
+	:type(Variable::VariableType::P_NULL), iValue(0), dValue(0), offset(0), length(0)
+{
+}
+
+static SharedValue captureValue(AALang* from, Variable& value, std::unordered_set<MapObject*>& open)
+{
+	SharedValue shared;
+	Variable& v = value.deref();
+	shared.type = v.type;
+
+	switch (v.type)
+	{
+	case Variable::VariableType::P_Int:
+		shared.iValue = v.iValue;
+		break;
+	case Variable::VariableType::P_Double:
+		shared.dValue = v.dValue;
+		break;
+	case Variable::VariableType::P_String:
+		if (v.sValue->mapping)
+		{
+			shared.mapping = v.sValue->mapping;
+			shared.offset = v.sValue->offset;
+			shared.length = v.sValue->length;
+		}
+		else
+			shared.text = std::string(v.string());
+		break;
+	case Variable::VariableType::P_Block:
+		shared.text = from->blockCache.source(v.blockId);
+		break;
+	case Variable::VariableType::P_Map:
+		// a map that contains itself is cut off where it repeats
+		if (!open.insert(v.mValue).second)
+		{
+			shared.type = Variable::VariableType::P_NULL;
+			break;
+		}
+		for (VariableMap::iterator it = v.mapValues().begin(); it != v.mapValues().end(); ++it)
+		{
+			Variable key = it.key();
+			shared.entries.emplace_back(captureValue(from, key, open), captureValue(from, it.value(), open));
+		}
+		open.erase(v.mValue);
+		break;
+	default:
+		shared.type = Variable::VariableType::P_NULL;
+		break;
+	}
+
+	return shared;
+}
+
+SharedValue SharedValue::capture(AALang* from, Variable& value)
+{
+	std::unordered_set<MapObject*> open;
+	return captureValue(from, value, open);
+}
+
+// allocates in the current heap, which has to be into's
+Variable SharedValue::restore(AALang* into) const
+{
+	switch (type)
+	{
+	case Variable::VariableType::P_Int:
+		return Variable(iValue);
+	case Variable::VariableType::P_Double:
+		return Variable(dValue);
+	case Variable::VariableType::P_String:
+		return mapping ? Variable::mapped(mapping, offset, length) : Variable(text);
+	case Variable::VariableType::P_Block:
+		return Variable::block(into->blockCache.intern(text));
+	case Variable::VariableType::P_Map:
+	{
+		Variable map = Variable::map();
+		for (auto& entry : entries)
+			map.mapValues()[entry.first.restore(into)] = entry.second.restore(into);
+		return map;
+	}
+	default:
+		return Variable();
+	}
+}
+
+ThreadPool::ThreadPool(size_t threads)
+	:task(nullptr), finish(nullptr), generation(0), running(0), stopping(false), error(nullptr)
+{
+	for (size_t i = 0; i < threads; i++)
+		workers.push_back(std::make_unique<Worker>());
+
+	// started once every Worker exists, they look at each other's queues
+	for (size_t i = 0; i < threads; i++)
+		workers[i]->thread = std::thread(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto& worker : workers)
+		worker->thread.join();
+}
+
+size_t ThreadPool::size() const
+{
+	return workers.size();
+}
+
+void ThreadPool::run(size_t chunks, const Task& task, const Finish& finish)
+{
+	size_t threads = workers.size();
+	for (size_t i = 0; i < threads; i++)
+	{
+		size_t first = chunks * i / threads;
+		size_t last = chunks * (i + 1) / threads;
+
+		std::lock_guard<std::mutex> guard(workers[i]->lock);
+		for (size_t chunk = first; chunk < last; chunk++)
+			workers[i]->chunks.push_back(chunk);
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	this->task = &task;
+	this->finish = &finish;
+	running = threads;
+	generation++;
+	wake.notify_all();
+
+	done.wait(guard, [this]() { return running == 0; });
+	this->task = nullptr;
+	this->finish = nullptr;
+
+	if (error)
+	{
+		std::exception_ptr thrown = error;
+		error = nullptr;
+		std::rethrow_exception(thrown);
+	}
+}
+
+// the worker's own chunks first, front to back, then one from the back of
+// whichever other worker still has some
+bool ThreadPool::take(size_t index, size_t& chunk)
+{
+	size_t threads = workers.size();
+	for (size_t i = 0; i < threads; i++)
+	{
+		Worker& victim = *workers[(index + i) % threads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (victim.chunks.empty())
+			continue;
+
+		if (i == 0)
+		{
+			chunk = victim.chunks.front();
+			victim.chunks.pop_front();
+		}
+		else
+		{
+			chunk = victim.chunks.back();
+			victim.chunks.pop_back();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+// keeps the first error for run(), the other workers stop taking chunks
+void ThreadPool::fail(std::exception_ptr thrown)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!error)
+			error = thrown;
+	}
+
+	for (auto& worker : workers)
+	{
+		std::lock_guard<std::mutex> guard(worker->lock);
+		worker->chunks.clear();
+	}
+}
+
+// built on the worker's thread so its heap belongs to it
+static std::unique_ptr<AALang> makeWorker()
+{
+	auto aaLang = std::make_unique<AALang>();
+	// a parallel call inside a worker runs on a pool of one
+	aaLang->parallelThreads = 1;
+	return aaLang;
+}
+
+void ThreadPool::work(size_t index)
+{
+	std::unique_ptr<AALang> aaLang = makeWorker();
+	uint64_t seen = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		size_t chunk;
+		bool failed = false;
+		try
+		{
+			while (take(index, chunk))
+				(*task)(*aaLang, index, chunk);
+		}
+		catch (...)
+		{
+			fail(std::current_exception());
+			failed = true;
+		}
+
+		try
+		{
+			(*finish)(*aaLang, index);
+		}
+		catch (...)
+		{
+			fail(std::current_exception());
+			failed = true;
+		}
+
+		// an exception can leave the interpreter in the middle of a call
+		if (failed)
+			aaLang = makeWorker();
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (--running == 0)
+			done.notify_all();
+	}
+}
+
+// every identifier in source, and in the blocks it contains
+static void collectIdentifiers(AALang* aaLang, const std::string& source, std::vector<std::string>& names)
+{
+	Program program;
+	aaLang->preParse(source, source.size(), &program);
+	for (auto& statement : program)
+	{
+		TokenList tokens;
+		aaLang->tokenizeLine(statement, &tokens);
+
+		for (auto& i : tokens)
+		{
+			if (i.type == Token::TokenType::T_Identifier)
+				names.emplace_back(i.value);
+			else if (i.type == Token::TokenType::T_Block)
+				collectIdentifiers(aaLang, std::string(i.value), names);
+		}
+	}
+}
+
+// the caller's globals the block names, directly or through blocks stored
+// in the globals it names
+static std::vector<std::pair<std::string, SharedValue>> captureShared(AALang* aaLang, const std::string& source)
+{
+	std::vector<std::pair<std::string, SharedValue>> shared;
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> names;
+	collectIdentifiers(aaLang, source, names);
+
+	while (!names.empty())
+	{
+		std::string name = std::move(names.back());
+		names.pop_back();
+		if (!seen.insert(name).second)
+			continue;
+
+		auto slot = aaLang->globalSlots.find(name);
+		if (slot == aaLang->globalSlots.end() || !aaLang->globalDefined[slot->second])
+			continue;
+
+		Variable& value = aaLang->globals[slot->second];
+		if (value.deref().type == Variable::VariableType::P_Block)
+			collectIdentifiers(aaLang, aaLang->blockCache.source(value.deref().blockId), names);
+		shared.emplace_back(name, SharedValue::capture(aaLang, value));
+	}
+
+	return shared;
+}
+
+Variable runParallel(AALang* aaLang, Variable items, int64_t start, Variable block,
+	Variable(*combine)(const Variable&, const Variable&))
+{
+	Variable& collection = items.deref();
+	Variable& code = block.deref();
+	std::string source = code.type == Variable::VariableType::P_Block ? aaLang->blockCache.source(code.blockId) : std::string(code.string());
+
+	// map items are copied out up front, a range is only its bounds
+	bool range = collection.type != Variable::VariableType::P_Map;
+	std::vector<std::pair<SharedValue, SharedValue>> entries;
+	size_t count = 0;
+	if (range)
+	{
+		int64_t end = collection.integer();
+		count = end > start ? (size_t)(end - start) : 0;
+	}
+	else
+	{
+		for (VariableMap::iterator it = collection.mapValues().begin(); it != collection.mapValues().end(); ++it)
+		{
+			Variable key = it.key();
+			entries.emplace_back(SharedValue::capture(aaLang, key), SharedValue::capture(aaLang, it.value()));
+		}
+		count = entries.size();
+	}
+
+	if (count == 0)
+		return combine ? Variable() : Variable::map();
+
+	std::vector<std::pair<std::string, SharedValue>> shared = captureShared(aaLang, source);
+
+	if (!aaLang->pool)
+	{
+		size_t threads = aaLang->parallelThreads ? aaLang->parallelThreads : std::thread::hardware_concurrency();
+		aaLang->pool = std::make_unique<ThreadPool>(std::max<size_t>(threads, 1));
+	}
+	ThreadPool& pool = *aaLang->pool;
+
+	size_t chunkSize = (count + maxChunks - 1) / maxChunks;
+	size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+	// what one worker set up for this call, it only touches its own
+	struct WorkerState
+	{
+		bool started = false;
+		int blockId = -1;
+		std::vector<int> slots;
+	};
+	std::vector<WorkerState> states(pool.size());
+	std::vector<SharedValue> partials(chunks);
+	std::vector<std::vector<std::pair<SharedValue, SharedValue>>> results(chunks);
+	std::vector<std::ostringstream> outputs(chunks);
+
+	ThreadPool::Task task = [&](AALang& worker, size_t index, size_t chunk) {
+		HeapScope scope(&worker.heap);
+		WorkerState& state = states[index];
+		if (!state.started)
+		{
+			state.started = true;
+			for (auto& variable : shared)
+			{
+				int slot = worker.resolveGlobal(variable.first);
+				worker.assignVariable(slot, variable.second.restore(&worker));
+				state.slots.push_back(slot);
+			}
+			state.blockId = worker.blockCache.intern(source);
+		}
+
+		// printed by the caller in chunk order once the call is done
+		worker.output.capture(&outputs[chunk]);
+
+		size_t first = chunk * chunkSize;
+		size_t last = std::min(count, first + chunkSize);
+		if (range)
+		{
+			worker.iterations.push_back({ Variable(), Variable(), Variable(), VariableMap::iterator(), start + (int64_t)first - 1, start + (int64_t)last, false });
+		}
+		else
+		{
+			Variable map = Variable::map();
+			for (size_t i = first; i < last; i++)
+				map.mapValues()[entries[i].first.restore(&worker)] = entries[i].second.restore(&worker);
+			worker.beginIteration(map, Variable(), Variable());
+		}
+
+		Variable sum;
+		while (worker.nextIteration())
+		{
+			Variable key = worker.iterations.back().key;
+
+			// every item runs in a frame of its own, like a block call
+			Variable result = worker.executeBlock(state.blockId).deref();
+
+			if (!combine)
+				results[chunk].emplace_back(SharedValue::capture(&worker, key), SharedValue::capture(&worker, result));
+			else if (result.type != Variable::VariableType::P_NULL)
+				sum = sum.type == Variable::VariableType::P_NULL ? result : combine(sum, result);
+		}
+
+		if (combine)
+			partials[chunk] = SharedValue::capture(&worker, sum);
+		worker.output.capture(nullptr);
+	};
+
+	// errors the workers reported count as the caller's
+	std::atomic<size_t> errors(0);
+
+	ThreadPool::Finish finish = [&](AALang& worker, size_t index) {
+		errors += worker.errors;
+		worker.errors = 0;
+
+		WorkerState& state = states[index];
+		if (!state.started)
+			return;
+
+		HeapScope scope(&worker.heap);
+		for (int slot : state.slots)
+		{
+			worker.globals[slot] = Variable();
+			worker.globalDefined[slot] = false;
+		}
+		// the blocks this call restored are garbage now, nothing runs
+		// between parallel calls to collect them otherwise
+		worker.maybeCollectBlocks();
+	};
+
+	pool.run(chunks, task, finish);
+	aaLang->errors += errors;
+
+	for (auto& text : outputs)
+		aaLang->output.write(text.str());
+
+	if (combine)
+	{
+		Variable sum;
+		for (SharedValue& partial : partials)
+		{
+			Variable value = partial.restore(aaLang);
+			if (value.type != Variable::VariableType::P_NULL)
+				sum = sum.type == Variable::VariableType::P_NULL ? value : combine(sum, value);
+		}
+		return sum;
+	}
+
+	Variable map = Variable::map();
+	for (auto& chunk : results)
+	{
+		for (auto& result : chunk)
+			map.mapValues()[result.first.restore(aaLang)] = result.second.restore(aaLang);
+	}
+	return map;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include "Variable.h"
+
+struct AALang;
+
+// A value copied out of one interpreter's heap so another interpreter can
+// rebuild it in its own. Nothing else crosses between a parallel call and
+// its workers. Blocks travel as source, mapped strings share the mapping.
+struct SharedValue
+{
+	SharedValue();
+
+	static SharedValue capture(AALang* from, Variable& value);
+	Variable restore(AALang* into) const;
+
+	Variable::VariableType type;
+	int64_t iValue;
+	double dValue;
+	std::string text;
+	std::shared_ptr<MappedFile> mapping;
+	size_t offset;
+	size_t length;
+	std::vector<std::pair<SharedValue, SharedValue>> entries;
+};
+
+// Threads that each own an interpreter for as long as the pool lives. A job
+// is split into numbered chunks, every worker starts with a contiguous run
+// of them and takes from the front of its own queue. Once that is empty it
+// steals from the back of the others, so uneven chunks even out.
+class ThreadPool
+{
+public:
+	// task(worker interpreter, worker index, chunk)
+	typedef std::function<void(AALang& worker, size_t index, size_t chunk)> Task;
+	// finish(worker interpreter, worker index), on every worker once its
+	// part of the job is done
+	typedef std::function<void(AALang& worker, size_t index)> Finish;
+
+	ThreadPool(size_t threads);
+	~ThreadPool();
+
+	size_t size() const;
+	// returns once every chunk ran and every worker finished. The first
+	// exception a task or finish threw is rethrown here, the chunks no
+	// worker had started by then are skipped.
+	void run(size_t chunks, const Task& task, const Finish& finish);
+
+private:
+	struct Worker
+	{
+		std::thread thread;
+		std::mutex lock;
+		std::deque<size_t> chunks;
+	};
+
+	void work(size_t index);
+	bool take(size_t index, size_t& chunk);
+	void fail(std::exception_ptr error);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const Task* task;
+	const Finish* finish;
+	uint64_t generation;
+	size_t running;
+	bool stopping;
+	std::exception_ptr error;
+};
+
+// Runs block once for every item on the interpreter's pool and returns the
+// results. items is a map, or a number n for the integers start to n - 1.
+// Inside the block value() and key() are the item, like in foreach.
+//
+// What the block sees: every global of the caller that the block, or a
+// block it refers to, names is copied into each worker when the call
+// starts. Assigning to one of those changes that worker's copy only, it is
+// never seen by the caller or the other workers and is gone when the call
+// returns. Anything else the block assigns is local to one item.
+//
+// What the blocks print comes out in the order of items once the call is
+// done, the same on any thread count.
+//
+// Without combine the result is a map from each item's key to its block
+// result, in the order of items. With combine the results are folded into
+// one value, in item order whatever the thread count, nulls are skipped.
+Variable runParallel(AALang* aaLang, Variable items, int64_t start, Variable block,
+	Variable(*combine)(const Variable&, const Variable&));
@@ -0,0 +1,200 @@
+#include "Profiler.h"
+#include "Heap.h"
+#include "Function.h"
+#include <algorithm>
+#include <iomanip>
+#include <string_view>
+
+// names longer than this are cut, a line can be a whole script
+static const size_t nameLength = 60;
+
+Profiler::Profiler(Heap* heap)
+	:heap(heap)
+{
+	// the root everything else hangs off
+	nodes.push_back({ name("all"), -1, {}, 0, 0, 0 });
+	stack.push_back({ 0, std::chrono::steady_clock::now(), heap->allocations });
+}
+
+// one line of text, folded stacks use ';' between frames
+static std::string shorten(const std::string& text)
+{
+	size_t end = text.find_last_not_of(" \t\r\n;");
+	std::string_view trimmed = std::string_view(text).substr(0, end == std::string::npos ? 0 : end + 1);
+
+	std::string result;
+	for (char c : trimmed)
+	{
+		if (result.size() == nameLength)
+		{
+			result += "...";
+			break;
+		}
+		if (c == '\n' || c == '\r' || c == '\t')
+			c = ' ';
+		if (c == ';')
+			c = ',';
+		if (c == ' ' && (result.empty() || result.back() == ' '))
+			continue;
+		result += c;
+	}
+	return result;
+}
+
+int Profiler::name(const std::string& text)
+{
+	auto found = names.find(text);
+	if (found != names.end())
+		return found->second;
+
+	int id = (int)nameText.size();
+	nameText.push_back(text);
+	names.emplace(text, id);
+	return id;
+}
+
+int Profiler::lineName(const std::string& line)
+{
+	return name("line: " + shorten(line));
+}
+
+int Profiler::blockName(int blockId, const std::string& source)
+{
+	if (blockId >= (int)blockNames.size())
+		blockNames.resize(blockId + 1, -1);
+	if (blockNames[blockId] < 0)
+		blockNames[blockId] = name("block: " + shorten(source));
+	return blockNames[blockId];
+}
+
+void Profiler::forgetBlock(int blockId)
+{
+	if (blockId < (int)blockNames.size())
+		blockNames[blockId] = -1;
+}
+
+void Profiler::forgetNative(const Function* function)
+{
+	nativeNames.erase(function);
+}
+
+int Profiler::nativeName(const Function* function)
+{
+	auto found = nativeNames.find(function);
+	if (found != nativeNames.end())
+		return found->second;
+
+	int id = name(function->identifier + "()");
+	nativeNames.emplace(function, id);
+	return id;
+}
+
+Profiler* Profiler::enter(int name)
+{
+	Node& parent = nodes[stack.back().node];
+	int node;
+	auto child = parent.children.find(name);
+	if (child != parent.children.end())
+	{
+		node = child->second;
+	}
+	else
+	{
+		node = (int)nodes.size();
+		nodes[stack.back().node].children.emplace(name, node);
+		nodes.push_back({ name, stack.back().node, {}, 0, 0, 0 });
+	}
+
+	stack.push_back({ node, std::chrono::steady_clock::now(), heap->allocations });
+	return this;
+}
+
+void Profiler::leave()
+{
+	Open& open = stack.back();
+	Node& node = nodes[open.node];
+	node.calls++;
+	node.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - open.start).count();
+	node.allocations += heap->allocations - open.allocations;
+	stack.pop_back();
+}
+
+void Profiler::report(std::ostream& out)
+{
+	struct Total
+	{
+		uint64_t calls = 0;
+		int64_t self = 0;
+		int64_t total = 0;
+		size_t allocations = 0;
+	};
+	std::vector<Total> totals(nameText.size());
+
+	// the root is still open, it is everything measured so far
+	Node& root = nodes[0];
+	root.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stack.front().start).count();
+	root.allocations = heap->allocations - stack.front().allocations;
+
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		Node& node = nodes[i];
+		Total& total = totals[node.name];
+		total.calls += node.calls;
+
+		int64_t self = node.ns;
+		size_t allocations = node.allocations;
+		for (auto& child : node.children)
+		{
+			self -= nodes[child.second].ns;
+			allocations -= nodes[child.second].allocations;
+		}
+		total.self += self;
+		total.allocations += allocations;
+
+		// a recursive call is already in its outermost caller's total
+		bool nested = false;
+		for (int parent = node.parent; parent > 0 && !nested; parent = nodes[parent].parent)
+			nested = nodes[parent].name == node.name;
+		if (!nested)
+			total.total += node.ns;
+	}
+
+	std::vector<int> order;
+	for (size_t i = 0; i < totals.size(); i++)
+	{
+		if (totals[i].calls > 0)
+			order.push_back((int)i);
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return totals[a].self > totals[b].self; });
+
+	out << "profile: " << root.ns / 1e6 << " ms, " << root.allocations << " allocations" << std::endl;
+	out << "self ms\ttotal ms\tcalls\tallocations\tname" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (int i : order)
+	{
+		Total& total = totals[i];
+		out << total.self / 1e6 << "\t" << total.total / 1e6 << "\t" << total.calls << "\t" << total.allocations << "\t" << nameText[i] << std::endl;
+	}
+	out << std::defaultfloat;
+}
+
+void Profiler::writeFolded(std::ostream& out)
+{
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		Node& node = nodes[i];
+		int64_t self = node.ns;
+		for (auto& child : node.children)
+			self -= nodes[child.second].ns;
+		if (self / 1000 <= 0)
+			continue;
+
+		std::vector<int> path;
+		for (int n = (int)i; n > 0; n = nodes[n].parent)
+			path.push_back(nodes[n].name);
+
+		for (size_t j = path.size(); j > 0; j--)
+			out << nameText[path[j - 1]] << (j > 1 ? ";" : "");
+		out << " " << self / 1000 << "\n";
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <unordered_map>
+
+class Heap;
+class Function;
+
+// Times every executeLine, executeBlock and builtin call while it is set on
+// an AALang, along with the heap allocations made meanwhile. Each distinct
+// call path is a node of a tree, which gives both the flat report and the
+// folded stacks flamegraph.pl reads. Nothing is measured while the
+// interpreter has no profiler, that costs one pointer test per call.
+class Profiler
+{
+public:
+	Profiler(Heap* heap);
+
+	// names for enter(), the same text always gets the same number
+	int lineName(const std::string& line);
+	int blockName(int blockId, const std::string& source);
+	int nativeName(const Function* function);
+	int name(const std::string& text);
+	// the id was released and may come back for another block
+	void forgetBlock(int blockId);
+	// the builtin was deleted, another one may get its address
+	void forgetNative(const Function* function);
+
+	Profiler* enter(int name);
+	void leave();
+
+	// calls, self and total time and allocations per name, slowest first
+	void report(std::ostream& out);
+	// one "outer;inner;name microseconds" line per call path
+	void writeFolded(std::ostream& out);
+
+private:
+	struct Node
+	{
+		int name;
+		int parent;
+		std::unordered_map<int, int> children;
+		uint64_t calls;
+		int64_t ns;
+		size_t allocations;
+	};
+
+	struct Open
+	{
+		int node;
+		std::chrono::steady_clock::time_point start;
+		size_t allocations;
+	};
+
+	Heap* heap;
+	std::vector<Node> nodes;
+	std::vector<Open> stack;
+
+	std::unordered_map<std::string, int> names;
+	std::vector<std::string> nameText;
+	std::vector<int> blockNames;
+	std::unordered_map<const Function*, int> nativeNames;
+};
+
+// leaves the profiler entered when it was made, if there was one
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler* profiler)
+		:profiler(profiler)
+	{
+	}
+	~ProfileScope()
+	{
+		if (profiler)
+			profiler->leave();
+	}
+
+private:
+	Profiler* profiler;
+};
@@ -0,0 +1,574 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include "ScriptCache.h"
+#include "MappedFile.h"
+#include "AALang.h"
+
+enum class ConstantTag : uint8_t {
+	Null = 0,
+	Int,
+	Double,
+	String,
+	Block,
+};
+
+template <typename T>
+static void write(std::string& out, T value)
+{
+	out.append((const char*)&value, sizeof(T));
+}
+
+static void writeString(std::string& out, std::string_view value)
+{
+	write<uint32_t>(out, (uint32_t)value.size());
+	out.append(value.data(), value.size());
+}
+
+// operand a of these is a global slot, stored as the global's name
+static bool usesGlobalSlot(OpCode op)
+{
+	return op == OpCode::OP_LoadVar || op == OpCode::OP_StoreVar || op == OpCode::OP_CallBlock;
+}
+
+// operand a is an index into AALang::natives, stored as the builtin's name
+static bool usesNative(OpCode op)
+{
+	return op == OpCode::OP_CallNative;
+}
+
+static bool isJump(OpCode op)
+{
+	return op == OpCode::OP_Jump || op == OpCode::OP_JumpIfFalse || op == OpCode::OP_JumpIfTrue
+		|| op == OpCode::OP_IterInit || op == OpCode::OP_IterNext;
+}
+
+// how many operands an instruction needs on the stack and what it leaves
+// there in their place
+static void stackEffect(const Instruction& instruction, int& pops, int& pushes)
+{
+	switch (instruction.op)
+	{
+	case OpCode::OP_PushConst:
+	case OpCode::OP_PushNull:
+	case OpCode::OP_LoadVar:
+	case OpCode::OP_LoadLocal:
+		pops = 0;
+		pushes = 1;
+		break;
+	case OpCode::OP_StoreVar:
+	case OpCode::OP_StoreLocal:
+		pops = 1;
+		pushes = instruction.b ? 0 : 1;
+		break;
+	case OpCode::OP_Assign:
+	case OpCode::OP_Index:
+		pops = 2;
+		pushes = 1;
+		break;
+	case OpCode::OP_CallNative:
+	case OpCode::OP_CallBlock:
+	case OpCode::OP_CallLocal:
+		pops = instruction.b;
+		pushes = 1;
+		break;
+	case OpCode::OP_Equals:
+	case OpCode::OP_Lt:
+	case OpCode::OP_Add:
+	case OpCode::OP_Sub:
+		pops = instruction.b ? 1 : 2;
+		pushes = 1;
+		break;
+	case OpCode::OP_ExecIfBlock:
+		pops = 1;
+		pushes = 1;
+		break;
+	case OpCode::OP_JumpIfFalse:
+	case OpCode::OP_JumpIfTrue:
+	case OpCode::OP_EndStatement:
+	case OpCode::OP_Pop:
+		pops = 1;
+		pushes = 0;
+		break;
+	case OpCode::OP_IterInit:
+		pops = 3;
+		pushes = 0;
+		break;
+	default:
+		pops = 0;
+		pushes = 0;
+		break;
+	}
+}
+
+// run() checks nothing, so every path through the code has to reach each
+// instruction with the same stack depth, never pop what the chunk didn't
+// push and end in OP_Return instead of running off the end
+static bool balancedStack(const Chunk& chunk)
+{
+	size_t size = chunk.code.size();
+	if (size == 0)
+		return false;
+
+	std::vector<int> depths(size, -1);
+	std::vector<size_t> pending(1, 0);
+	depths[0] = 0;
+
+	auto reach = [&](size_t target, int depth) {
+		if (target >= size)
+			return false;
+		if (depths[target] < 0)
+		{
+			depths[target] = depth;
+			pending.push_back(target);
+			return true;
+		}
+		return depths[target] == depth;
+	};
+
+	while (!pending.empty())
+	{
+		size_t pc = pending.back();
+		pending.pop_back();
+
+		const Instruction& instruction = chunk.code[pc];
+		int pops, pushes;
+		stackEffect(instruction, pops, pushes);
+		if (pops < 0 || depths[pc] < pops)
+			return false;
+
+		int depth = depths[pc] - pops + pushes;
+		if (isJump(instruction.op) && !reach((size_t)instruction.a, depth))
+			return false;
+		if (instruction.op != OpCode::OP_Jump && instruction.op != OpCode::OP_Return && !reach(pc + 1, depth))
+			return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+T ScriptCache::Reader::read()
+{
+	T value = T();
+	if (failed || (size_t)(end - position) < sizeof(T))
+	{
+		failed = true;
+		return value;
+	}
+
+	std::memcpy(&value, position, sizeof(T));
+	position += sizeof(T);
+	return value;
+}
+
+std::string_view ScriptCache::Reader::readString()
+{
+	uint32_t size = read<uint32_t>();
+	if (failed || (size_t)(end - position) < size)
+	{
+		failed = true;
+		return std::string_view();
+	}
+
+	std::string_view value(position, size);
+	position += size;
+	return value;
+}
+
+ScriptCache::ScriptCache(AALang* aaLang)
+	:aaLang(aaLang), failed(false)
+{
+}
+
+// 64 bit FNV-1a
+uint64_t ScriptCache::hash(std::string_view data)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (char c : data)
+	{
+		h ^= (unsigned char)c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+// $XDG_CACHE_HOME/aalang, ~/.cache/aalang or %LOCALAPPDATA%\aalang, the
+// temporary directory when none of them is set
+std::filesystem::path ScriptCache::cacheDirectory()
+{
+	const char* xdg = std::getenv("XDG_CACHE_HOME");
+	if (xdg && *xdg)
+		return std::filesystem::path(xdg) / "aalang";
+
+#ifdef _WIN32
+	const char* local = std::getenv("LOCALAPPDATA");
+	if (local && *local)
+		return std::filesystem::path(local) / "aalang";
+#else
+	const char* home = std::getenv("HOME");
+	if (home && *home)
+		return std::filesystem::path(home) / ".cache" / "aalang";
+#endif
+
+	std::error_code error;
+	return std::filesystem::temp_directory_path(error) / "aalang";
+}
+
+// scripts with the same name in different directories get their own cache
+std::filesystem::path ScriptCache::cachePath(const std::filesystem::path& scriptPath)
+{
+	std::error_code error;
+	std::filesystem::path full = std::filesystem::weakly_canonical(scriptPath, error);
+	if (error)
+		full = scriptPath;
+
+	char pathHash[17];
+	std::snprintf(pathHash, sizeof(pathHash), "%016llx", (unsigned long long)hash(full.string()));
+	return cacheDirectory() / (scriptPath.stem().string() + "-" + pathHash + ".aalc");
+}
+
+// everything a cache depends on besides the source: the opcodes, and the
+// builtins compiled calls refer to and the compiler folds
+uint64_t ScriptCache::version() const
+{
+	std::string signature = std::to_string((int)OpCode::OP_Return + 1);
+	for (Function* native : aaLang->natives)
+	{
+		signature += ' ';
+		signature += native->identifier;
+		signature += '/';
+		signature += std::to_string(native->parameterCount);
+		if (native->pure)
+			signature += " pure";
+	}
+	return hash(signature);
+}
+
+bool ScriptCache::load(const std::filesystem::path& path, uint64_t sourceHash, Program* p)
+{
+	MappedFile file(path);
+	if (!file.isOpen())
+		return false;
+
+	return load(file.view(), sourceHash, p);
+}
+
+bool ScriptCache::load(std::string_view data, uint64_t sourceHash, Program* p)
+{
+	if (data.substr(0, 4) != "AALC")
+		return false;
+
+	Reader in{ data.data() + 4, data.data() + data.size(), false };
+	if (in.read<uint64_t>() != version() || in.read<uint64_t>() != sourceHash)
+		return false;
+
+	uint32_t symbolCount = in.read<uint32_t>();
+	for (uint32_t i = 0; i < symbolCount && !in.failed; ++i)
+		loadedSymbols.push_back(in.readString());
+	slots.assign(loadedSymbols.size(), -1);
+	natives.assign(loadedSymbols.size(), -1);
+	strings.assign(loadedSymbols.size(), Variable());
+
+	uint32_t count = in.read<uint32_t>();
+	Program program;
+	std::vector<Chunk*> chunks;
+	for (uint32_t i = 0; i < count && !in.failed; ++i)
+	{
+		program.emplace_back(in.readString());
+		chunks.push_back(readChunk(in));
+	}
+
+	if (in.failed)
+	{
+		for (Chunk* chunk : chunks)
+			delete chunk;
+		return false;
+	}
+
+	for (size_t i = 0; i < program.size(); ++i)
+		aaLang->lineCache.insert(program[i], std::shared_ptr<Chunk>(chunks[i]));
+
+	p->insert(p->end(), program.begin(), program.end());
+	return true;
+}
+
+std::string ScriptCache::serialize(uint64_t sourceHash, const Program& p)
+{
+	std::string body;
+	write<uint32_t>(body, (uint32_t)p.size());
+	for (auto& statement : p)
+	{
+		std::shared_ptr<Chunk> chunk = aaLang->lineCache.find(statement);
+		if (!chunk)
+		{
+			chunk = std::shared_ptr<Chunk>(aaLang->compiler.compileLine(statement));
+			aaLang->lineCache.insert(statement, chunk);
+		}
+
+		writeString(body, statement);
+		writeChunk(body, chunk.get());
+	}
+
+	std::string out = "AALC";
+	write<uint64_t>(out, version());
+	write<uint64_t>(out, sourceHash);
+	write<uint32_t>(out, (uint32_t)symbols.size());
+	for (auto& i : symbols)
+		writeString(out, i);
+	out += body;
+	return out;
+}
+
+void ScriptCache::save(const std::filesystem::path& path, uint64_t sourceHash, const Program& p)
+{
+	std::string out = serialize(sourceHash, p);
+
+	// the diagnostics were printed while compiling, a cache would hide them
+	// on every later run
+	if (failed)
+		return;
+
+	std::error_code directoryError;
+	std::filesystem::create_directories(path.parent_path(), directoryError);
+	if (directoryError)
+		return;
+
+	// several interpreters may start on the same script at once, never let
+	// one of them see a half written cache
+	std::filesystem::path temporary = path;
+	temporary += ".tmp" + std::to_string(std::random_device()());
+	{
+		std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file)
+			return;
+
+		file.write(out.data(), out.size());
+		if (!file)
+		{
+			file.close();
+			std::error_code ignored;
+			std::filesystem::remove(temporary, ignored);
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+		std::filesystem::remove(temporary, error);
+}
+
+uint32_t ScriptCache::symbol(std::string_view value)
+{
+	auto found = symbolIds.find(std::string(value));
+	if (found != symbolIds.end())
+		return found->second;
+
+	uint32_t id = (uint32_t)symbols.size();
+	symbols.emplace_back(value);
+	symbolIds.emplace(symbols.back(), id);
+	return id;
+}
+
+void ScriptCache::writeChunk(std::string& out, Chunk* chunk)
+{
+	if (chunk->failed)
+		failed = true;
+
+	write<uint32_t>(out, (uint32_t)chunk->locals.size());
+	for (int slot : chunk->locals)
+		write<uint32_t>(out, symbol(aaLang->globalNames[slot]));
+
+	write<uint32_t>(out, (uint32_t)chunk->code.size());
+	for (auto& instruction : chunk->code)
+	{
+		write<uint8_t>(out, (uint8_t)instruction.op);
+		if (usesGlobalSlot(instruction.op))
+			write<uint32_t>(out, symbol(aaLang->globalNames[instruction.a]));
+		else if (usesNative(instruction.op))
+			write<uint32_t>(out, symbol(aaLang->natives[instruction.a]->identifier));
+		else
+			write<int32_t>(out, instruction.a);
+		write<int32_t>(out, instruction.b);
+	}
+
+	write<uint32_t>(out, (uint32_t)chunk->constants.size());
+	for (auto& constant : chunk->constants)
+	{
+		switch (constant.type)
+		{
+		case Variable::VariableType::P_Int:
+			write<uint8_t>(out, (uint8_t)ConstantTag::Int);
+			write<int64_t>(out, constant.iValue);
+			break;
+		case Variable::VariableType::P_Double:
+			write<uint8_t>(out, (uint8_t)ConstantTag::Double);
+			write<double>(out, constant.dValue);
+			break;
+		case Variable::VariableType::P_String:
+			write<uint8_t>(out, (uint8_t)ConstantTag::String);
+			write<uint32_t>(out, symbol(constant.string()));
+			break;
+		case Variable::VariableType::P_Block:
+		{
+			// blocks travel with their own compiled chunk, compiled now if they never ran
+			CachedBlock& cached = aaLang->blockCache.get(constant.blockId);
+			if (!cached.chunk)
+				cached.chunk = std::shared_ptr<Chunk>(aaLang->compiler.compileBlock(aaLang->blockCache.source(constant.blockId)));
+			std::shared_ptr<Chunk> blockChunk = cached.chunk;
+
+			write<uint8_t>(out, (uint8_t)ConstantTag::Block);
+			writeString(out, aaLang->blockCache.source(constant.blockId));
+
+			// prefixed with its size so a loader without room for it can skip it
+			size_t sizePosition = out.size();
+			write<uint32_t>(out, 0);
+			writeChunk(out, blockChunk.get());
+			uint32_t size = (uint32_t)(out.size() - sizePosition - sizeof(uint32_t));
+			std::memcpy(&out[sizePosition], &size, sizeof(size));
+			break;
+		}
+		default:
+			write<uint8_t>(out, (uint8_t)ConstantTag::Null);
+			break;
+		}
+	}
+}
+
+Chunk* ScriptCache::readChunk(Reader& in)
+{
+	Chunk* chunk = new Chunk();
+
+	// symbols are resolved the first time any chunk refers to them
+	auto readSymbol = [&]() {
+		uint32_t id = in.read<uint32_t>();
+		if (id >= loadedSymbols.size())
+		{
+			in.failed = true;
+			return (uint32_t)0;
+		}
+		return id;
+	};
+
+	auto readSlot = [&]() {
+		uint32_t id = readSymbol();
+		if (!in.failed && slots[id] < 0)
+			slots[id] = aaLang->resolveGlobal(std::string(loadedSymbols[id]));
+		return in.failed ? 0 : slots[id];
+	};
+
+	uint32_t localCount = in.read<uint32_t>();
+	for (uint32_t i = 0; i < localCount && !in.failed; ++i)
+		chunk->locals.push_back(readSlot());
+
+	uint32_t codeCount = in.read<uint32_t>();
+	chunk->code.reserve(in.failed ? 0 : std::min<size_t>(codeCount, in.end - in.position));
+	for (uint32_t i = 0; i < codeCount && !in.failed; ++i)
+	{
+		Instruction instruction;
+		instruction.op = (OpCode)in.read<uint8_t>();
+		if (usesGlobalSlot(instruction.op))
+		{
+			instruction.a = readSlot();
+		}
+		else if (usesNative(instruction.op))
+		{
+			uint32_t id = readSymbol();
+			if (!in.failed && natives[id] < 0)
+			{
+				// a builtin this interpreter doesn't have, the cache is of no use
+				auto native = aaLang->functions.find(std::string(loadedSymbols[id]));
+				if (native == aaLang->functions.end())
+					in.failed = true;
+				else
+					natives[id] = native->second->index;
+			}
+			instruction.a = in.failed ? 0 : natives[id];
+		}
+		else
+		{
+			instruction.a = in.read<int32_t>();
+		}
+		instruction.b = in.read<int32_t>();
+		chunk->code.push_back(instruction);
+	}
+
+	uint32_t constantCount = in.read<uint32_t>();
+	for (uint32_t i = 0; i < constantCount && !in.failed; ++i)
+	{
+		switch ((ConstantTag)in.read<uint8_t>())
+		{
+		case ConstantTag::Int:
+			chunk->constants.push_back(Variable(in.read<int64_t>()));
+			break;
+		case ConstantTag::Double:
+			chunk->constants.push_back(Variable(in.read<double>()));
+			break;
+		case ConstantTag::String:
+		{
+			// one shared immutable string per distinct literal, like the compiler does
+			uint32_t id = readSymbol();
+			if (in.failed)
+				break;
+			if (strings[id].type != Variable::VariableType::P_String)
+				strings[id] = Variable(std::string(loadedSymbols[id]));
+			chunk->constants.push_back(strings[id]);
+			break;
+		}
+		case ConstantTag::Block:
+		{
+			int blockId = aaLang->blockCache.intern(std::string(in.readString()));
+			uint32_t size = in.read<uint32_t>();
+			if (in.failed || (size_t)(in.end - in.position) < size)
+			{
+				in.failed = true;
+				break;
+			}
+
+			// only fill the block cache while it has room, evicting what was
+			// loaded a moment ago would just throw the work away
+			BlockCache& blockCache = aaLang->blockCache;
+			if (blockCache.capacity == 0 || blockCache.size() < blockCache.capacity)
+			{
+				std::shared_ptr<Chunk> blockChunk(readChunk(in));
+				CachedBlock& cached = blockCache.get(blockId);
+				if (!cached.chunk && !in.failed)
+					cached.chunk = blockChunk;
+			}
+			else
+			{
+				in.position += size;
+			}
+
+			chunk->constants.push_back(Variable::block(blockId));
+			break;
+		}
+		case ConstantTag::Null:
+			chunk->constants.push_back(Variable());
+			break;
+		default:
+			in.failed = true;
+			break;
+		}
+	}
+
+	for (auto& instruction : chunk->code)
+	{
+		if (instruction.op > OpCode::OP_Return
+			|| ((instruction.op == OpCode::OP_PushConst || (instruction.b && (instruction.op == OpCode::OP_Equals || instruction.op == OpCode::OP_Lt || instruction.op == OpCode::OP_Add || instruction.op == OpCode::OP_Sub)))
+				&& (uint32_t)instruction.a >= chunk->constants.size())
+			|| ((instruction.op == OpCode::OP_LoadLocal || instruction.op == OpCode::OP_StoreLocal || instruction.op == OpCode::OP_CallLocal)
+				&& (uint32_t)instruction.a >= chunk->locals.size())
+			|| (instruction.op == OpCode::OP_CallNative && instruction.b < aaLang->natives[instruction.a]->parameterCount)
+			|| (isJump(instruction.op) && (uint32_t)instruction.a >= chunk->code.size()))
+			in.failed = true;
+	}
+	if (!in.failed && !balancedStack(*chunk))
+		in.failed = true;
+
+	return chunk;
+}
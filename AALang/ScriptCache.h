@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <filesystem>
+#include "Token.h"
+#include "Bytecode.h"
+
+struct AALang;
+
+// A script compiled into the cache format and kept in memory. Nothing
+// changes it once it is built, so interpreters on any number of threads
+// can load it at the same time, each resolving the symbols for itself.
+struct CompiledScript
+{
+	uint64_t sourceHash;
+	std::string image;
+};
+
+// Compiled form of a script kept as <name>-<path hash>.aalc in the user's
+// cache directory. The file is keyed by a hash of the source and of the
+// builtins and opcodes the interpreter has, a cache that doesn't match
+// either is ignored and rewritten.
+//
+// Global slots, natives and block ids are only meaningful inside one
+// interpreter, so they are written by name (or source) into a symbol table
+// and resolved again, once per symbol, when the cache is loaded.
+class ScriptCache
+{
+public:
+	ScriptCache(AALang* aaLang);
+
+	static uint64_t hash(std::string_view data);
+	static std::filesystem::path cacheDirectory();
+	static std::filesystem::path cachePath(const std::filesystem::path& scriptPath);
+
+	// fills p with the statements and hands their chunks to the line cache
+	bool load(const std::filesystem::path& path, uint64_t sourceHash, Program* p);
+	bool load(std::string_view image, uint64_t sourceHash, Program* p);
+	// nothing is saved if a statement or block failed to compile
+	void save(const std::filesystem::path& path, uint64_t sourceHash, const Program& p);
+	std::string serialize(uint64_t sourceHash, const Program& p);
+
+private:
+	struct Reader
+	{
+		const char* position;
+		const char* end;
+		bool failed;
+
+		template <typename T>
+		T read();
+		std::string_view readString();
+	};
+
+	uint64_t version() const;
+	uint32_t symbol(std::string_view value);
+	void writeChunk(std::string& out, Chunk* chunk);
+
+	Chunk* readChunk(Reader& in);
+
+	AALang* aaLang;
+	// set by serialize() when it wrote a chunk that failed to compile
+	bool failed;
+
+	std::vector<std::string> symbols;
+	std::unordered_map<std::string, uint32_t> symbolIds;
+
+	// resolved on first use while loading
+	std::vector<std::string_view> loadedSymbols;
+	std::vector<int> slots;
+	std::vector<int> natives;
+	std::vector<Variable> strings;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+// Statements already compiled or tokenized, keyed by their text. Only the
+// most recently used capacity of them are kept, a capacity of 0 disables
+// the bound. Values are shared, a statement that is still running keeps
+// its own reference and survives being evicted.
+template <typename T>
+class StatementCache
+{
+public:
+	StatementCache(size_t capacity)
+		:capacity(capacity), evictions(0)
+	{
+	}
+
+	// nullptr when line isn't cached
+	std::shared_ptr<T> find(const std::string& line)
+	{
+		auto found = entries.find(line);
+		if (found == entries.end())
+			return nullptr;
+
+		lru.splice(lru.begin(), lru, found->second.lruPosition);
+		return found->second.value;
+	}
+
+	// an entry that is already there is kept
+	void insert(const std::string& line, std::shared_ptr<T> value)
+	{
+		auto inserted = entries.emplace(line, Entry{ std::move(value), lru.end() });
+		if (!inserted.second)
+			return;
+
+		// the key of a node never moves, the list can point at it
+		lru.push_front(&inserted.first->first);
+		inserted.first->second.lruPosition = lru.begin();
+		while (capacity > 0 && entries.size() > capacity)
+			evict();
+	}
+
+	template <typename Visit>
+	void forEach(Visit visit)
+	{
+		for (auto& entry : entries)
+			visit(*entry.second.value);
+	}
+
+	void clear()
+	{
+		lru.clear();
+		entries.clear();
+	}
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+
+	size_t capacity;
+	size_t evictions;
+
+private:
+	struct Entry
+	{
+		std::shared_ptr<T> value;
+		std::list<const std::string*>::iterator lruPosition;
+	};
+
+	void evict()
+	{
+		auto oldest = entries.find(*lru.back());
+		lru.pop_back();
+		entries.erase(oldest);
+		evictions++;
+	}
+
+	std::unordered_map<std::string, Entry> entries;
+	std::list<const std::string*> lru;
+};
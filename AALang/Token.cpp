@@ -1,9 +1,10 @@
 #include "Token.h"
 
-Token::Token(std::string value, TokenType type)
-	:value(value), type(type)
+Token::Token(std::string_view value, TokenType type, int line, int column)
+	:value(value), type(type), line(line), column(column)
 {
-
+	if (type == TokenType::T_Number)
+		Variable::parseNumber(value, constant);
 }
 
 std::string Token::typeToString()
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include "Variable.h"
+
 class Token
 {
 public:
@@ -22,11 +25,19 @@ public:
 		T_EndOfLine,
 	};
 
-	Token(std::string value, TokenType type);
+	Token(std::string_view value, TokenType type, int line = 0, int column = 0);
 	std::string typeToString();
 
-	std::string value;
+	// a view into the source the line was tokenized from
+	std::string_view value;
 	TokenType type;
+	int line;
+	int column;
+
+	// number and string literals are materialized once when the line is tokenized,
+	// strings with their escapes resolved
+	Variable constant;
 };
 
 typedef std::vector<Token> TokenList;
+typedef std::vector<std::string> Program;
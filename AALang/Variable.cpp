@@ -1,36 +1,155 @@
 #include "Variable.h"
 #include <iostream>
+#include <cstring>
+#include <charconv>
+#include <vector>
 
-Variable::Variable()
+Variable::Variable(const std::string& value)
 {
-	type = VariableType::P_NULL;
-	sValue = "";
-	fValue = 0;
-	registered = false;
+	type = VariableType::P_String;
+	sValue = Heap::current()->newString(value);
 }
-Variable::Variable(std::string value, bool block)
+
+void Variable::releaseObject()
 {
-	type = VariableType::P_String;
-	sValue = value;
-	fValue = 0;
+	if (type == VariableType::P_String)
+	{
+		sValue->heap->releaseString(sValue);
+	}
+	else if (--mValue->refCount == 0)
+	{
+		mValue->heap->freeMap(mValue);
+	}
+}
+
+bool Variable::parseNumber(std::string_view text, Variable& number)
+{
+	const char* first = text.data();
+	const char* last = text.data() + text.size();
 
-	if (block)
+	if (text.find_first_of(".eE") == std::string_view::npos)
 	{
-		type = VariableType::P_Block;
+		int64_t i;
+		auto result = std::from_chars(first, last, i);
+		if (result.ec == std::errc())
+		{
+			number = Variable(i);
+			return true;
+		}
 	}
-	registered = false;
+
+	// too large for an integer or written as a fraction
+	double d;
+	auto result = std::from_chars(first, last, d);
+	if (result.ec != std::errc())
+	{
+		number = Variable();
+		return false;
+	}
+	number = Variable(d);
+	return true;
+}
+
+Variable Variable::mapped(std::shared_ptr<MappedFile> file)
+{
+	size_t length = file->view().size();
+	return mapped(std::move(file), 0, length);
 }
-Variable::Variable(float value)
+
+Variable Variable::mapped(std::shared_ptr<MappedFile> file, size_t offset, size_t length)
 {
-	type = VariableType::P_Float;
-	sValue = "";
-	fValue = value;
-	registered = false;
+	Variable v;
+	v.type = VariableType::P_String;
+	v.sValue = Heap::current()->newString(std::string());
+	v.sValue->mapping = std::move(file);
+	v.sValue->offset = offset;
+	v.sValue->length = length;
+	return v;
 }
 
-Variable::~Variable()
+// pieces shorter than this are copied, a rope node costs more than the copy
+static const size_t shortString = 64;
+
+Variable Variable::concat(const Variable& left, const Variable& right)
 {
-	//std::cout << "Deconstructing " << typeToString() << std::endl;
+	if (right.sValue->length == 0)
+		return left;
+	if (left.sValue->length == 0)
+		return right;
+
+	if (left.sValue->length + right.sValue->length <= shortString)
+		return Variable(std::string(left.string()).append(right.string()));
+
+	Variable v;
+	v.type = VariableType::P_String;
+	v.sValue = Heap::current()->newConcat(left.sValue, right.sValue);
+	return v;
+}
+
+// walks the rope with a stack of its own, a string appended to in a loop
+// is as deep as the loop was long
+void StringObject::flatten()
+{
+	std::string text;
+	text.reserve(length);
+
+	std::vector<StringObject*> pending = { right, left };
+	while (!pending.empty())
+	{
+		StringObject* s = pending.back();
+		pending.pop_back();
+
+		if (s->left)
+		{
+			pending.push_back(s->right);
+			pending.push_back(s->left);
+		}
+		else
+		{
+			text.append(s->view());
+		}
+	}
+
+	value = std::move(text);
+	left->heap->releaseString(left);
+	right->heap->releaseString(right);
+	left = nullptr;
+	right = nullptr;
+}
+
+Variable Variable::block(int blockId)
+{
+	Variable v;
+	v.type = VariableType::P_Block;
+	v.blockId = blockId;
+	return v;
+}
+Variable Variable::map()
+{
+	Variable v;
+	v.type = VariableType::P_Map;
+	v.mValue = Heap::current()->newMap();
+	return v;
+}
+
+std::string_view Variable::string() const
+{
+	if (type == VariableType::P_String)
+	{
+		if (sValue->left)
+			sValue->flatten();
+		return sValue->view();
+	}
+
+	if (type == VariableType::P_Ref)
+		return ref->string();
+
+	return std::string_view();
+}
+
+VariableMap& Variable::mapValues()
+{
+	return deref().mValue->values;
 }
 
 std::string Variable::toString()
@@ -39,14 +158,20 @@ std::string Variable::toString()
 		return "NULL";
 
 	if (type == VariableType::P_String)
-		return sValue;
+		return std::string(string());
+
+	if (type == VariableType::P_Int)
+		return std::to_string(iValue);
 
-	if (type == VariableType::P_Float)
-		return std::to_string(fValue);
+	if (type == VariableType::P_Double)
+		return std::to_string(dValue);
 
 	if (type == VariableType::P_Block)
 		return "{ BLOCK }";
 
+	if (type == VariableType::P_Ref)
+		return ref->toString();
+
 	return "";
 }
 
@@ -58,8 +183,11 @@ std::string Variable::typeToString()
 	if (type == VariableType::P_String)
 		return "P_String";
 
-	if (type == VariableType::P_Float)
-		return "P_Float";
+	if (type == VariableType::P_Int)
+		return "P_Int";
+
+	if (type == VariableType::P_Double)
+		return "P_Double";
 
 	if (type == VariableType::P_Block)
 		return "P_Block";
@@ -67,5 +195,8 @@ std::string Variable::typeToString()
 	if (type == VariableType::P_Map)
 		return "P_Map";
 
+	if (type == VariableType::P_Ref)
+		return "P_Ref";
+
 	return std::string();
 }
@@ -1,33 +1,255 @@
 #pragma once
 
 #include <string>
-#include <map>
+#include <string_view>
 #include <memory>
+#include <cstring>
+#include <cstdint>
+#include "Heap.h"
+#include "MappedFile.h"
+#include "VariableMap.h"
+
+// run() is too large for the compilers to inline these on their own
+#if defined(_MSC_VER)
+#define AALANG_INLINE __forceinline
+#else
+#define AALANG_INLINE inline __attribute__((always_inline))
+#endif
+
 class Variable;
+struct StringObject;
+struct MapObject;
 
+// A tagged value. Integers, doubles, null and blocks (by blockId) are stored inline,
+// strings and maps live behind an intrusively refcounted pointer, so copying
+// a Variable never allocates. P_Ref points at another Variable's storage and
+// is how a script variable is handed to a builtin that writes to it.
 class Variable
 {
 public:
-	enum class VariableType {
+	enum class VariableType : uint8_t {
 		P_NULL = 0,
 		P_String,
-		P_Float,
+		P_Int,
+		P_Double,
 		P_Block,
 		P_Map,
+		P_Ref,
 	};
 
 	Variable();
-	Variable(std::string value, bool block = false);
-	Variable(float value);
+	Variable(int64_t value);
+	Variable(double value);
+	Variable(const std::string& value);
 
+	// parses an integer or double literal without allocating, false and
+	// number left NULL when text isn't one
+	static bool parseNumber(std::string_view text, Variable& number);
+	// a string backed by the whole of a mapped file, or by length bytes of
+	// it from offset on
+	static Variable mapped(std::shared_ptr<MappedFile> file);
+	static Variable mapped(std::shared_ptr<MappedFile> file, size_t offset, size_t length);
+	// two strings added together, see StringObject
+	static Variable concat(const Variable& left, const Variable& right);
+	static Variable block(int blockId);
+	static Variable map();
+	static Variable reference(Variable* target);
+
+	Variable(const Variable& other);
+	Variable(Variable&& other) noexcept;
+	Variable& operator=(const Variable& other);
+	Variable& operator=(Variable&& other) noexcept;
 	~Variable();
 
+	Variable& deref();
+	double number() const;
+	int64_t integer() const;
+	std::string_view string() const;
+	VariableMap& mapValues();
+
 	std::string toString();
 	std::string typeToString();
 
 	VariableType type;
-	std::string sValue;
-	std::map<std::string, std::shared_ptr<Variable>> mValue;
-	float fValue;
-	bool registered;
-};
\ No newline at end of file
+	union
+	{
+		int64_t iValue;
+		double dValue;
+		int blockId;
+		StringObject* sValue;
+		MapObject* mValue;
+		Variable* ref;
+	};
+
+private:
+	void retain();
+	void release();
+	void releaseObject();
+};
+
+// Strings are immutable. Adding two long strings makes a rope node that
+// only points at both pieces, the text is put together the first time
+// something reads it, so appending in a loop stays linear.
+struct StringObject
+{
+	int refCount;
+	Heap* heap;
+	std::string value;
+
+	// when set the string is length bytes of the mapped file from offset
+	// on and value stays empty
+	std::shared_ptr<MappedFile> mapping;
+
+	// set until the rope is flattened into value
+	StringObject* left;
+	StringObject* right;
+	size_t length;
+	size_t offset;
+
+	std::string_view view() const
+	{
+		return mapping ? mapping->view().substr(offset, length) : std::string_view(value);
+	}
+	void flatten();
+};
+
+struct MapObject
+{
+	MapObject(Heap* heap)
+		:refCount(1), gcRefs(0), heap(heap), prev(nullptr), next(nullptr), values(heap)
+	{
+	}
+
+	int refCount;
+	int gcRefs;
+	Heap* heap;
+	MapObject* prev;
+	MapObject* next;
+	VariableMap values;
+};
+
+// copying, destroying and dereferencing happen several times per executed
+// instruction, keep them inline
+
+AALANG_INLINE Variable::Variable()
+{
+	type = VariableType::P_NULL;
+	iValue = 0;
+}
+
+AALANG_INLINE Variable::Variable(int64_t value)
+{
+	type = VariableType::P_Int;
+	iValue = value;
+}
+
+AALANG_INLINE Variable::Variable(double value)
+{
+	type = VariableType::P_Double;
+	dValue = value;
+}
+
+AALANG_INLINE Variable::Variable(const Variable& other)
+{
+	type = other.type;
+	std::memcpy(&iValue, &other.iValue, sizeof(iValue));
+	retain();
+}
+
+AALANG_INLINE Variable::Variable(Variable&& other) noexcept
+{
+	type = other.type;
+	std::memcpy(&iValue, &other.iValue, sizeof(iValue));
+	other.type = VariableType::P_NULL;
+}
+
+AALANG_INLINE Variable& Variable::operator=(const Variable& other)
+{
+	if (this != &other)
+	{
+		Variable copy(other);
+		*this = std::move(copy);
+	}
+	return *this;
+}
+
+AALANG_INLINE Variable& Variable::operator=(Variable&& other) noexcept
+{
+	if (this != &other)
+	{
+		// other may live inside the map we're about to release, take it first
+		Variable taken(std::move(other));
+
+		release();
+		type = taken.type;
+		std::memcpy(&iValue, &taken.iValue, sizeof(iValue));
+		taken.type = VariableType::P_NULL;
+	}
+	return *this;
+}
+
+AALANG_INLINE Variable::~Variable()
+{
+	release();
+}
+
+AALANG_INLINE void Variable::retain()
+{
+	if (type == VariableType::P_String)
+		sValue->refCount++;
+	else if (type == VariableType::P_Map)
+		mValue->refCount++;
+}
+
+AALANG_INLINE void Variable::release()
+{
+	if (type == VariableType::P_String || type == VariableType::P_Map)
+		releaseObject();
+	type = VariableType::P_NULL;
+}
+
+AALANG_INLINE Variable Variable::reference(Variable* target)
+{
+	Variable v;
+	v.type = VariableType::P_Ref;
+	v.ref = target;
+	return v;
+}
+
+AALANG_INLINE Variable& Variable::deref()
+{
+	Variable* v = this;
+	while (v->type == VariableType::P_Ref)
+		v = v->ref;
+	return *v;
+}
+
+AALANG_INLINE double Variable::number() const
+{
+	const Variable* v = this;
+	while (v->type == VariableType::P_Ref)
+		v = v->ref;
+
+	if (v->type == VariableType::P_Double)
+		return v->dValue;
+
+	if (v->type == VariableType::P_Int)
+		return (double)v->iValue;
+
+	return 0;
+}
+
+AALANG_INLINE int64_t Variable::integer() const
+{
+	const Variable* v = this;
+	while (v->type == VariableType::P_Ref)
+		v = v->ref;
+
+	if (v->type == VariableType::P_Int)
+		return v->iValue;
+
+	if (v->type == VariableType::P_Double)
+		return (int64_t)v->dValue;
+
+	return 0;
+}
@@ -0,0 +1,401 @@
+#include "VariableMap.h"
+#include "Variable.h"
+#include <charconv>
+#include <new>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+struct VariableMap::Entry
+{
+	// a key of the hash part, it stays in its entry for good
+	Variable key;
+	Variable value;
+	uint32_t hash;
+};
+
+static const size_t firstChunkBits = 2;
+static const size_t smallMapEntries = 8;
+
+static int highestBit(uint64_t n)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, n);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(n);
+#endif
+}
+
+template <typename T>
+ChunkedArray<T>::ChunkedArray(Heap* heap)
+	:heap(heap), count(0), first(nullptr), chunks(PoolAllocator<T*>(heap))
+{
+}
+
+template <typename T>
+ChunkedArray<T>::~ChunkedArray()
+{
+	clear();
+}
+
+// chunk c starts at element 4 * (2^c - 1)
+template <typename T>
+T& ChunkedArray<T>::operator[](size_t i)
+{
+	size_t n = i + ((size_t)1 << firstChunkBits);
+	int chunk = highestBit(n) - (int)firstChunkBits;
+	if (chunk == 0)
+		return first[i];
+	return chunks[chunk - 1][n - ((size_t)1 << (chunk + firstChunkBits))];
+}
+
+template <typename T>
+T& ChunkedArray<T>::push_back(T&& value)
+{
+	if (!first)
+		first = (T*)heap->allocate(sizeof(T) << firstChunkBits);
+	else if (count + ((size_t)1 << firstChunkBits) == ((size_t)1 << (chunks.size() + 1 + firstChunkBits)))
+		chunks.push_back((T*)heap->allocate(sizeof(T) << (chunks.size() + 1 + firstChunkBits)));
+
+	T* element = new (&(*this)[count]) T(std::move(value));
+	count++;
+	return *element;
+}
+
+template <typename T>
+void ChunkedArray<T>::clear()
+{
+	for (size_t i = 0; i < count; ++i)
+		(*this)[i].~T();
+
+	if (first)
+		heap->deallocate(first, sizeof(T) << firstChunkBits);
+	for (size_t c = 0; c < chunks.size(); ++c)
+		heap->deallocate(chunks[c], sizeof(T) << (c + 1 + firstChunkBits));
+
+	first = nullptr;
+	chunks.clear();
+	count = 0;
+}
+
+// only the spelling std::to_string would produce, "01", "+1" and "-0" stay strings
+static bool integerKey(std::string_view key, int64_t& out)
+{
+	if (key.empty() || key.size() > 20)
+		return false;
+
+	size_t digits = key[0] == '-' ? 1 : 0;
+	if (digits == key.size() || (key[digits] == '0' && (key.size() > digits + 1 || digits == 1)))
+		return false;
+
+	auto result = std::from_chars(key.data(), key.data() + key.size(), out);
+	return result.ec == std::errc() && result.ptr == key.data() + key.size();
+}
+
+static bool integerKey(const Variable& key, int64_t& out)
+{
+	if (key.type == Variable::VariableType::P_Int)
+	{
+		out = key.iValue;
+		return true;
+	}
+
+	if (key.type == Variable::VariableType::P_Double)
+	{
+		double d = key.dValue;
+		if (d >= -9.2e18 && d <= 9.2e18 && d == (double)(int64_t)d)
+		{
+			out = (int64_t)d;
+			return true;
+		}
+		return false;
+	}
+
+	if (key.type == Variable::VariableType::P_String)
+		return integerKey(key.string(), out);
+
+	return false;
+}
+
+static uint32_t hashInt(int64_t key)
+{
+	return (uint32_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// 32 bit FNV-1a
+static uint32_t hashString(std::string_view key)
+{
+	uint32_t h = 2166136261u;
+	for (char c : key)
+	{
+		h ^= (unsigned char)c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+VariableMap::iterator::iterator()
+	:map(nullptr), inHash(true), position(0)
+{
+}
+
+VariableMap::iterator::iterator(VariableMap* map, bool inHash, size_t position)
+	:map(map), inHash(inHash), position(position)
+{
+	leaveArray();
+}
+
+void VariableMap::iterator::leaveArray()
+{
+	if (!inHash && position >= map->array.size())
+	{
+		inHash = true;
+		position = 0;
+	}
+}
+
+Variable VariableMap::iterator::key() const
+{
+	if (inHash)
+		return map->entries[position].key;
+	return Variable((int64_t)position);
+}
+
+Variable& VariableMap::iterator::value() const
+{
+	if (inHash)
+		return map->entries[position].value;
+	return map->array[position];
+}
+
+VariableMap::iterator& VariableMap::iterator::operator++()
+{
+	position++;
+	leaveArray();
+	return *this;
+}
+
+bool VariableMap::iterator::operator==(const iterator& other) const
+{
+	return inHash == other.inHash && position == other.position;
+}
+
+bool VariableMap::iterator::operator!=(const iterator& other) const
+{
+	return !(*this == other);
+}
+
+VariableMap::VariableMap(Heap* heap)
+	:heap(heap), array(heap), entries(heap), slots(nullptr), capacity(0), usedSlots(0), liveEntries(0)
+{
+}
+
+VariableMap::~VariableMap()
+{
+	clear();
+}
+
+template <typename Matches>
+VariableMap::Entry* VariableMap::findEntry(uint32_t hash, Matches matches)
+{
+	if (liveEntries == 0)
+		return nullptr;
+
+	if (!slots)
+	{
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			Entry& entry = entries[i];
+			if (entry.hash == hash && matches(entry.key))
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	size_t mask = capacity - 1;
+	for (size_t slot = hash & mask; slots[slot] >= 0; slot = (slot + 1) & mask)
+	{
+		Entry& entry = entries[slots[slot]];
+		if (entry.hash == hash && matches(entry.key))
+			return &entry;
+	}
+	return nullptr;
+}
+
+VariableMap::Entry* VariableMap::findEntry(int64_t key)
+{
+	return findEntry(hashInt(key), [key](const Variable& v) {
+		return v.type == Variable::VariableType::P_Int && v.iValue == key;
+	});
+}
+
+VariableMap::Entry* VariableMap::findEntry(std::string_view key, uint32_t hash)
+{
+	return findEntry(hash, [key](const Variable& v) {
+		return v.type == Variable::VariableType::P_String && v.string() == key;
+	});
+}
+
+Variable* VariableMap::find(const Variable& key)
+{
+	int64_t i;
+	if (integerKey(key, i))
+	{
+		if (i >= 0 && (uint64_t)i < array.size())
+			return &array[i];
+
+		Entry* entry = findEntry(i);
+		return entry ? &entry->value : nullptr;
+	}
+
+	if (key.type == Variable::VariableType::P_String)
+	{
+		Entry* entry = findEntry(key.string(), hashString(key.string()));
+		return entry ? &entry->value : nullptr;
+	}
+
+	// every other type is keyed by how it prints
+	Variable copy(key);
+	return find(std::string_view(copy.toString()));
+}
+
+Variable* VariableMap::find(std::string_view key)
+{
+	int64_t i;
+	if (integerKey(key, i))
+		return find(Variable(i));
+
+	Entry* entry = findEntry(key, hashString(key));
+	return entry ? &entry->value : nullptr;
+}
+
+Variable& VariableMap::operator[](const Variable& key)
+{
+	int64_t i;
+	if (integerKey(key, i))
+		return atInt(i);
+
+	if (key.type == Variable::VariableType::P_String)
+		return atString(key.string(), &key);
+
+	Variable copy(key);
+	return atString(copy.toString(), nullptr);
+}
+
+Variable& VariableMap::operator[](std::string_view key)
+{
+	int64_t i;
+	if (integerKey(key, i))
+		return atInt(i);
+
+	return atString(key, nullptr);
+}
+
+Variable& VariableMap::atInt(int64_t key)
+{
+	if (key >= 0 && (uint64_t)key < array.size())
+		return array[key];
+
+	// a key that is already in the hash part stays there, a reference to its
+	// value may be held while the array part grows
+	Entry* entry = findEntry(key);
+	if (entry)
+		return entry->value;
+	if ((uint64_t)key != array.size())
+		return insert(Variable(key), hashInt(key));
+
+	return array.push_back(Variable());
+}
+
+// shared is the string Variable the key came from, the map keeps a
+// reference to it instead of copying the text
+Variable& VariableMap::atString(std::string_view key, const Variable* shared)
+{
+	uint32_t hash = hashString(key);
+	Entry* entry = findEntry(key, hash);
+	if (entry)
+		return entry->value;
+
+	return insert(shared ? Variable(*shared) : Variable(std::string(key)), hash);
+}
+
+Variable& VariableMap::insert(Variable&& key, uint32_t hash)
+{
+	if (!slots && entries.size() < smallMapEntries)
+	{
+		liveEntries++;
+		return entries.push_back(Entry{ std::move(key), Variable(), hash }).value;
+	}
+
+	if ((usedSlots + 1) * 4 > capacity * 3)
+		rehash();
+
+	size_t mask = capacity - 1;
+	size_t slot = hash & mask;
+	while (slots[slot] >= 0)
+		slot = (slot + 1) & mask;
+
+	slots[slot] = (int32_t)entries.size();
+	usedSlots++;
+	liveEntries++;
+
+	Entry& entry = entries.push_back(Entry{ std::move(key), Variable(), hash });
+	return entry.value;
+}
+
+// entries stay where they are, only the slots pointing at them are rebuilt
+void VariableMap::rehash()
+{
+	size_t newCapacity = 8;
+	while ((liveEntries + 1) * 2 > newCapacity)
+		newCapacity *= 2;
+
+	if (slots)
+		heap->deallocate(slots, capacity * sizeof(int32_t));
+	slots = (int32_t*)heap->allocate(newCapacity * sizeof(int32_t));
+	capacity = newCapacity;
+	for (size_t i = 0; i < capacity; ++i)
+		slots[i] = -1;
+
+	size_t mask = capacity - 1;
+	usedSlots = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		Entry& entry = entries[i];
+		size_t slot = entry.hash & mask;
+		while (slots[slot] >= 0)
+			slot = (slot + 1) & mask;
+		slots[slot] = (int32_t)i;
+		usedSlots++;
+	}
+}
+
+size_t VariableMap::size() const
+{
+	return array.size() + liveEntries;
+}
+
+void VariableMap::clear()
+{
+	array.clear();
+	entries.clear();
+
+	if (slots)
+		heap->deallocate(slots, capacity * sizeof(int32_t));
+	slots = nullptr;
+	capacity = 0;
+	usedSlots = 0;
+	liveEntries = 0;
+}
+
+VariableMap::iterator VariableMap::begin()
+{
+	return iterator(this, false, 0);
+}
+
+VariableMap::iterator VariableMap::end()
+{
+	return iterator(this, true, entries.size());
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "Heap.h"
+
+class Variable;
+
+// Grows in chunks, each twice the size of the one before, so an element
+// never moves once it is in. Only VariableMap uses it, the members are
+// defined in VariableMap.cpp.
+template <typename T>
+class ChunkedArray
+{
+public:
+	ChunkedArray(Heap* heap);
+	~ChunkedArray();
+
+	T& operator[](size_t i);
+	T& push_back(T&& value);
+	void clear();
+	size_t size() const { return count; }
+
+private:
+	Heap* heap;
+	size_t count;
+
+	// the first chunk is the only one most maps ever need
+	T* first;
+	std::vector<T*, PoolAllocator<T*>> chunks;
+};
+
+// A script map, laid out like a Lua table: integer keys counting up from 0
+// live in a dense array part, every other key in an open addressing hash
+// part. Integers, whole doubles and strings spelling an integer all name
+// the same key. A key never moves between the parts once it is in, so
+// values keep their address while the map grows and [] can hand out
+// references into it.
+class VariableMap
+{
+public:
+	struct Entry;
+
+	// walks the array part, then the hash part in insertion order. Every
+	// key in the map when the walk starts is visited once, keys added on
+	// the way are visited if they land behind the iterator.
+	class iterator
+	{
+	public:
+		iterator();
+
+		Variable key() const;
+		Variable& value() const;
+
+		iterator& operator++();
+		iterator& operator*() { return *this; }
+		bool operator==(const iterator& other) const;
+		bool operator!=(const iterator& other) const;
+
+	private:
+		friend class VariableMap;
+		iterator(VariableMap* map, bool inHash, size_t position);
+		void leaveArray();
+
+		VariableMap* map;
+		bool inHash;
+		size_t position;
+	};
+
+	VariableMap(Heap* heap);
+	~VariableMap();
+	VariableMap(const VariableMap&) = delete;
+	VariableMap& operator=(const VariableMap&) = delete;
+
+	// nullptr when the key isn't in the map
+	Variable* find(const Variable& key);
+	Variable* find(std::string_view key);
+
+	// inserts NULL when the key isn't in the map
+	Variable& operator[](const Variable& key);
+	Variable& operator[](std::string_view key);
+
+	size_t size() const;
+	void clear();
+
+	iterator begin();
+	iterator end();
+
+private:
+	template <typename Matches>
+	Entry* findEntry(uint32_t hash, Matches matches);
+	Entry* findEntry(int64_t key);
+	Entry* findEntry(std::string_view key, uint32_t hash);
+
+	Variable& atInt(int64_t key);
+	Variable& atString(std::string_view key, const Variable* shared);
+	Variable& insert(Variable&& key, uint32_t hash);
+	void rehash();
+
+	Heap* heap;
+	ChunkedArray<Variable> array;
+	ChunkedArray<Entry> entries;
+
+	// indices into entries, -1 for a free slot. Small maps have none and
+	// search entries directly.
+	int32_t* slots;
+	size_t capacity;
+	size_t usedSlots;
+	size_t liveEntries;
+};
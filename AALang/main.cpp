@@ -0,0 +1,178 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+#include "AALang.h"
+#include "Interpreters.h"
+
+static void usage()
+{
+	std::cout << "usage: aalang [options] [script.aal [args...]]" << std::endl;
+	std::cout << "  -e code          run code instead of a script" << std::endl;
+	std::cout << "  --repl           read more lines from stdin once the script is done" << std::endl;
+	std::cout << "  --print-results  print the result of every line" << std::endl;
+	std::cout << "  --tree-walk      use the tree-walking interpreter" << std::endl;
+	std::cout << "  --threads N      run the script on N interpreters at once" << std::endl;
+	std::cout << "  --profile path   write a profile to path.txt and path.folded" << std::endl;
+	std::cout << "With no script and no -e the interpreter starts as a REPL." << std::endl;
+	std::cout << "The exit code is 1 if anything reported an error." << std::endl;
+}
+
+// the whole of text as a number, false if it isn't one
+static bool parseCount(const std::string& text, size_t& count)
+{
+	try
+	{
+		size_t used;
+		count = std::stoul(text, &used);
+		return used == text.size() && text[0] != '-';
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+static void runProgram(AALang& aaLang, Program& program, bool printResults)
+{
+	for (auto& i : program)
+	{
+		Variable result = aaLang.executeLine(i);
+		if (printResults)
+		{
+			aaLang.output.flush();
+			std::cout << ">> " << result.toString() << std::endl;
+		}
+	}
+	aaLang.output.flush();
+}
+
+int main(int argc, char** argv)
+{
+	std::unique_ptr<AALang> aaLang = std::make_unique<AALang>();
+	size_t threads = 0;
+	bool repl = false;
+	bool printResults = false;
+	bool hasCode = false;
+	std::string code;
+	std::string script;
+	std::vector<std::string> arguments;
+
+	// options come first, everything after the script belongs to it
+	int i = 1;
+	for (; i < argc; ++i)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--tree-walk")
+			aaLang->treeWalk = true;
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			std::string count(argv[++i]);
+			if (!parseCount(count, threads))
+			{
+				std::cout << "--threads needs a number, not " << count << std::endl;
+				usage();
+				return 2;
+			}
+		}
+		else if (arg == "--profile" && i + 1 < argc)
+			aaLang->startProfiling(argv[++i]);
+		else if (arg == "-e" && i + 1 < argc)
+		{
+			hasCode = true;
+			code = argv[++i];
+		}
+		else if (arg == "--repl")
+			repl = true;
+		else if (arg == "--print-results")
+			printResults = true;
+		else if (arg == "--help" || arg == "-h")
+		{
+			usage();
+			return 0;
+		}
+		else if (arg == "--")
+		{
+			++i;
+			break;
+		}
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			std::cout << "Unknown option: " << arg << std::endl;
+			usage();
+			return 2;
+		}
+		else
+			break;
+	}
+
+	if (!hasCode && i < argc)
+		script = argv[i++];
+	arguments.push_back(hasCode ? "-e" : script);
+	for (; i < argc; ++i)
+		arguments.push_back(argv[i]);
+
+	// the script on N interpreters at once, each sees its number in shard
+	if (threads > 0)
+	{
+		if (script.empty())
+		{
+			std::cout << "--threads needs a script" << std::endl;
+			return 2;
+		}
+		std::shared_ptr<const CompiledScript> compiled = aaLang->compileScript(script);
+		if (!compiled)
+			return 1;
+
+		bool treeWalk = aaLang->treeWalk;
+		// compile errors were reported here, the workers load the script quietly
+		std::atomic<size_t> errors(aaLang->errors);
+		runInterpreters(threads, [&](AALang& worker, size_t index) {
+			worker.treeWalk = treeWalk;
+			worker.setArguments(arguments);
+			worker.assignVariable("shard", Variable((int64_t)index));
+			worker.assignVariable("shards", Variable((int64_t)threads));
+
+			Program workerProgram;
+			if (worker.loadScript(*compiled, &workerProgram))
+				runProgram(worker, workerProgram, printResults);
+			errors += worker.errors;
+		});
+		return errors > 0 ? 1 : 0;
+	}
+
+	aaLang->setArguments(arguments);
+
+	Program program;
+	if (hasCode)
+		loadSource(code, &program, aaLang.get());
+	else if (!script.empty())
+		loadProgram(script, &program, aaLang.get());
+	else
+		repl = true;
+
+	runProgram(*aaLang, program, printResults);
+
+	if (repl)
+	{
+		std::string cmd;
+		while (true)
+		{
+			std::cout << ">> ";
+			if (!std::getline(std::cin, cmd) || cmd == "quit" || cmd == "exit")
+				break;
+
+			Variable result = aaLang->executeLine(cmd);
+			aaLang->output.flush();
+			std::cout << ">> " << result.toString() << std::endl;
+		}
+	}
+
+	// the destructor flushes and writes the profile
+	size_t errors = aaLang->errors;
+	aaLang.reset();
+	return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <exception>
+#include "Bench.h"
+
+// the whole of text as a number, false if it isn't one
+static bool parseCount(const std::string& text, int& count)
+{
+	try
+	{
+		size_t used;
+		count = std::stoi(text, &used);
+		return used == text.size();
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+static void usage()
+{
+	std::cout << "usage: AALangBench [--suite [directory]] [--json path] [--repeat N]" << std::endl;
+}
+
+// without arguments the microbenchmarks run. With --suite [directory] the
+// workloads there run instead and their results go out as JSON, to the
+// --json file if one is given, --repeat sets the runs per workload.
+int main(int argc, char** argv)
+{
+	bool suite = false;
+	std::string directory = "workloads";
+	std::string jsonPath;
+	int repeat = 3;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--suite")
+		{
+			suite = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				directory = argv[++i];
+		}
+		else if (arg == "--json" && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (arg == "--repeat" && i + 1 < argc)
+		{
+			std::string count(argv[++i]);
+			if (!parseCount(count, repeat))
+			{
+				std::cout << "--repeat needs a number, not " << count << std::endl;
+				usage();
+				return 2;
+			}
+			repeat = std::max(1, repeat);
+		}
+	}
+
+	if (suite)
+	{
+		if (jsonPath.empty())
+			return runSuite(directory, repeat, std::cout);
+
+		std::ofstream json(jsonPath);
+		return runSuite(directory, repeat, json);
+	}
+
+	variableAccessBench();
+	allocationBench();
+	callBench();
+	mapBench();
+	stringBench();
+	outputBench();
+	parallelBench();
+	fileBench();
+	lexerBench();
+}
@@ -0,0 +1,39 @@
+#include <iostream>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+
+// runs a while loop once to compile everything and then counts the
+// operator new calls and heap blocks of a second run
+static void countLoop(const std::string& name, const std::string& body, int iterations, const std::string& setup = "")
+{
+	const std::string loop = "while({lt(a, " + std::to_string(iterations) + ");}, {" + body + " a = add(a, 1);});";
+
+	AALang aaLang;
+	aaLang.executeLine("a = 0; m = 0;");
+	if (!setup.empty())
+		aaLang.executeLine(setup);
+	aaLang.executeLine(loop);
+
+	aaLang.executeLine("a = 0;");
+	size_t before = allocationCount();
+	size_t heapBefore = aaLang.heap.allocations;
+	aaLang.executeLine(loop);
+	size_t allocated = allocationCount() - before;
+	size_t heapAllocated = aaLang.heap.allocations - heapBefore;
+
+	std::cout << name << "\t" << iterations << "\t" << (double)allocated / iterations << "\t" << (double)heapAllocated / iterations << "\t" << aaLang.heap.liveBlocks << std::endl;
+}
+
+void allocationBench()
+{
+	const int iterations = 100000;
+
+	std::cout << "loop allocations" << std::endl;
+	std::cout << "loop\titerations\tnew per iteration\theap per iteration\tlive heap blocks" << std::endl;
+	countLoop("test.aal", "", iterations);
+	countLoop("string literal", "m = \"literal\";", iterations);
+	countLoop("map churn", "m = 0; setMap(m, \"k\", a);", iterations);
+	countLoop("string churn", "m = add(\"str\", \"ing\"); m = add(m, \"!\");", iterations);
+	countLoop("block call", "m = f(a);", iterations, "f = { x = pop(); y = add(x, 1); y; };");
+}
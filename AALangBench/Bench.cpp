@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include "Bench.h"
+#include "AALang.h"
+
+// the parallel benchmarks allocate from several threads at once
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+size_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+double elapsedMs(AALang& aaLang, const std::string& line)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	aaLang.executeLine(line);
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+double measureNs(size_t iterations, std::function<void()> action)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		action();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <filesystem>
+
+struct AALang;
+
+// Runs action iterations times and returns the average cost of one
+// iteration in nanoseconds.
+double measureNs(size_t iterations, std::function<void()> action);
+
+// number of operator new calls made by the benchmark process so far, on
+// any thread
+size_t allocationCount();
+
+// ms aaLang takes to execute line
+double elapsedMs(AALang& aaLang, const std::string& line);
+
+void variableAccessBench();
+void allocationBench();
+void lexerBench();
+void callBench();
+void mapBench();
+void stringBench();
+void outputBench();
+void parallelBench();
+void fileBench();
+
+// runs the .aal workloads in directory, see Suite.cpp, and writes JSON to
+// out. Returns nonzero when one of them failed.
+int runSuite(const std::filesystem::path& directory, int repeat, std::ostream& out);
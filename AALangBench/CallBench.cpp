@@ -0,0 +1,76 @@
+#include <iostream>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+
+// add(add(add(a, 1), 1), 1)... with depth calls, a is a variable so
+// the compiler can't fold any of it
+static std::string nestedAdd(int depth)
+{
+	std::string expression = "a";
+	for (int i = 0; i < depth; ++i)
+		expression = "add(" + expression + ", 1)";
+	return "x = " + expression + ";";
+}
+
+static double callCost(int depth, bool treeWalk)
+{
+	const size_t iterations = treeWalk ? 200 : 2000;
+
+	AALang aaLang;
+	aaLang.treeWalk = treeWalk;
+	aaLang.executeLine("a = 0; x = 0;");
+
+	int blockId = aaLang.blockCache.intern(nestedAdd(depth));
+	aaLang.executeBlock(blockId);
+
+	return measureNs(iterations, [&]() { aaLang.executeBlock(blockId); }) / depth;
+}
+
+// a block of statements, minus the same block without the call
+static double builtinCost(const std::string& call)
+{
+	const int callsPerBlock = 100;
+	const size_t iterations = 2000;
+
+	AALang aaLang;
+	aaLang.executeLine("a = 7;");
+	aaLang.executeLine("x = 0;");
+	aaLang.executeLine("m = 0;");
+	aaLang.executeLine("setMap(m, \"k\", 1);");
+
+	std::string block;
+	std::string baseline;
+	for (int i = 0; i < callsPerBlock; ++i)
+	{
+		block += "x = " + call + ";";
+		baseline += "x = a;";
+	}
+	int blockId = aaLang.blockCache.intern(block);
+	int baselineId = aaLang.blockCache.intern(baseline);
+	aaLang.executeBlock(blockId);
+	aaLang.executeBlock(baselineId);
+
+	double ns = measureNs(iterations, [&]() { aaLang.executeBlock(blockId); });
+	double baselineNs = measureNs(iterations, [&]() { aaLang.executeBlock(baselineId); });
+	return (ns - baselineNs) / callsPerBlock;
+}
+
+void callBench()
+{
+	std::cout << "native calls (ns per call of nested add)" << std::endl;
+	std::cout << "depth\tbytecode\ttree-walk" << std::endl;
+
+	for (int depth : { 1, 10, 100 })
+	{
+		std::cout << depth << "\t" << callCost(depth, false) << "\t" << callCost(depth, true) << std::endl;
+	}
+
+	std::cout << "builtin call overhead (bytecode, ns per call)" << std::endl;
+	std::cout << "call\tns" << std::endl;
+	for (const char* call : { "equals(a, 1)", "lt(a, 1)", "add(a, 1)", "sub(a, 1)", "gt(a, 1)", "mul(a, 2)", "div(a, 2)", "mod(a, 3)",
+		"abs(a)", "and(a, 1)", "getMap(m, \"k\")", "setMap(m, \"k\", a)", "timeMS()" })
+	{
+		std::cout << call << "\t" << builtinCost(call) << std::endl;
+	}
+}
@@ -0,0 +1,43 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <filesystem>
+#include "Bench.h"
+#include "AALang.h"
+
+// reads a log of lines with readLine() and copies it with writeLine()
+void fileBench()
+{
+	const int lines = 500000;
+	std::filesystem::path in = std::filesystem::temp_directory_path() / "AALangBench.log";
+	std::filesystem::path out = std::filesystem::temp_directory_path() / "AALangBench.copy";
+	{
+		std::ofstream log(in, std::ios::binary);
+		for (int i = 0; i < lines; i++)
+			log << "2024-01-01 12:00:00 INFO request " << i << " served in 12ms\n";
+	}
+	double megabytes = std::filesystem::file_size(in) / (1024.0 * 1024.0);
+
+	AALang aaLang;
+	aaLang.executeLine("l = 0;");
+	aaLang.executeLine("f = openFile(\"" + in.generic_string() + "\", \"r\");");
+	double read = elapsedMs(aaLang, "while({equals(eof(f), 0);}, { l = readLine(f); });");
+	aaLang.executeLine("close(f);");
+
+	aaLang.executeLine("f = openFile(\"" + in.generic_string() + "\", \"r\");");
+	aaLang.executeLine("o = openFile(\"" + out.generic_string() + "\", \"w\");");
+	auto start = std::chrono::high_resolution_clock::now();
+	aaLang.executeLine("while({equals(eof(f), 0);}, { writeLine(o, readLine(f)); });");
+	aaLang.executeLine("close(o);");
+	double copy = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	aaLang.executeLine("close(f);");
+
+	std::cout << "streaming a " << megabytes << " MB log (" << lines << " lines)" << std::endl;
+	std::cout << "operation\tms\tMB/s" << std::endl;
+	std::cout << "readLine\t" << read << "\t" << megabytes / (read / 1000) << std::endl;
+	std::cout << "readLine + writeLine\t" << copy << "\t" << megabytes / (copy / 1000) << std::endl;
+
+	std::error_code ignored;
+	std::filesystem::remove(in, ignored);
+	std::filesystem::remove(out, ignored);
+}
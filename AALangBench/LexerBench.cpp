@@ -0,0 +1,88 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+#include "ScriptCache.h"
+
+// statements in the shape of the generated scripts we load at startup
+static std::string generateScript(size_t size)
+{
+	std::string script;
+	for (int i = 0; script.size() < size; ++i)
+	{
+		std::string n = std::to_string(i);
+		script += "value" + n + " = add(value" + n + ", 12345);\n";
+		script += "setMap(table, \"key\\t" + n + "\", -1.5);\n";
+		script += "ifelse(lt(counter, " + n + "), { print(\"less\\n\"); }, { counter = sub(counter, 1); });\n";
+		script += "// generated line " + n + "\n";
+	}
+	return script;
+}
+
+void lexerBench()
+{
+	const size_t iterations = 5;
+
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "aalang_lexer_bench.aal";
+	std::string script = generateScript(8 * 1024 * 1024);
+	{
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+		file << script;
+	}
+	double megabytes = script.size() / (1024.0 * 1024.0);
+
+	AALang aaLang;
+	aaLang.useScriptCache = false;
+	HeapScope scope(&aaLang.heap);
+
+	Program program;
+	double loadNs = measureNs(iterations, [&]() {
+		program.clear();
+		loadProgram(path, &program, &aaLang);
+	});
+
+	size_t tokens = 0;
+	double tokenizeNs = measureNs(iterations, [&]() {
+		tokens = 0;
+		for (auto& line : program)
+		{
+			TokenList list;
+			aaLang.tokenizeLine(line, &list);
+			tokens += list.size();
+		}
+	});
+
+	// what a fresh interpreter pays before it can run the first statement,
+	// compiling everything itself or loading the compiled cache
+	double compileNs = measureNs(iterations, [&]() {
+		AALang fresh;
+		fresh.useScriptCache = false;
+		Program freshProgram;
+		loadProgram(path, &freshProgram, &fresh);
+		for (auto& line : freshProgram)
+			fresh.lineCache.insert(line, std::shared_ptr<Chunk>(fresh.compiler.compileLine(line)));
+	});
+
+	{
+		AALang writer;
+		Program writerProgram;
+		loadProgram(path, &writerProgram, &writer);
+	}
+	double cachedNs = measureNs(iterations, [&]() {
+		AALang fresh;
+		Program freshProgram;
+		loadProgram(path, &freshProgram, &fresh);
+	});
+
+	std::filesystem::remove(path);
+	std::filesystem::remove(ScriptCache::cachePath(path));
+
+	std::cout << "lexer throughput (" << megabytes << " MB, " << program.size() << " statements, " << tokens << " tokens)" << std::endl;
+	std::cout << "stage\tms\tMB/s" << std::endl;
+	std::cout << "loadProgram\t" << loadNs / 1e6 << "\t" << megabytes / (loadNs / 1e9) << std::endl;
+	std::cout << "tokenizeLine\t" << tokenizeNs / 1e6 << "\t" << megabytes / (tokenizeNs / 1e9) << std::endl;
+	std::cout << "startup, parse and compile\t" << compileNs / 1e6 << "\t" << megabytes / (compileNs / 1e9) << std::endl;
+	std::cout << "startup, compiled cache\t" << cachedNs / 1e6 << "\t" << megabytes / (cachedNs / 1e9) << std::endl;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+
+// runs body for i from 0 to count once and returns the ns per iteration,
+// minus the same loop with an empty body
+static double loopCost(AALang& aaLang, const std::string& body, int count)
+{
+	auto run = [&](const std::string& loopBody) {
+		aaLang.executeLine("i = 0;");
+		auto start = std::chrono::high_resolution_clock::now();
+		aaLang.executeLine("while({lt(i, " + std::to_string(count) + ");}, {" + loopBody + " i = add(i, 1);});");
+		return std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / count;
+	};
+
+	double baseline = run("");
+	return run(body) - baseline;
+}
+
+static void mapCost(const std::string& name, const std::string& key, int count)
+{
+	AALang aaLang;
+	aaLang.executeLine("i = 0;");
+	aaLang.executeLine("x = 0;");
+	aaLang.executeLine("m = 0;");
+
+	double build = loopCost(aaLang, "m[" + key + "] = i;", count);
+	double read = loopCost(aaLang, "x = m[" + key + "];", count);
+	std::cout << name << "\t" << count << "\t" << build << "\t" << read << std::endl;
+}
+
+// ns per element of foreach(collection, k, v, { x = v; }), setup builds
+// the collection in m
+static void foreachCost(const std::string& name, const std::string& setup, const std::string& collection, int count)
+{
+	AALang aaLang;
+	aaLang.executeLine("i = 0;");
+	aaLang.executeLine("x = 0;");
+	aaLang.executeLine("k = 0;");
+	aaLang.executeLine("v = 0;");
+	aaLang.executeLine("m = 0;");
+	aaLang.executeLine("while({lt(i, " + std::to_string(count) + ");}, {" + setup + " i = add(i, 1);});");
+
+	const std::string loop = "foreach(" + collection + ", k, v, { x = v; });";
+	aaLang.executeLine(loop);
+	auto start = std::chrono::high_resolution_clock::now();
+	aaLang.executeLine(loop);
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / count;
+	std::cout << name << "\t" << count << "\t" << ns << std::endl;
+}
+
+void mapBench()
+{
+	std::cout << "map indexing (ns per access)" << std::endl;
+	std::cout << "keys\tcount\tinsert\tread" << std::endl;
+	mapCost("integer", "i", 1000000);
+	mapCost("whole double", "mul(i, 1.0)", 1000000);
+	mapCost("sparse integer", "mul(i, 7)", 1000000);
+	mapCost("string", "add(\"k\", i)", 100000);
+
+	std::cout << "foreach (ns per element)" << std::endl;
+	std::cout << "collection\tcount\tns" << std::endl;
+	foreachCost("integer keys", "m[i] = i;", "m", 1000000);
+	foreachCost("string keys", "m[add(\"k\", i)] = i;", "m", 100000);
+	foreachCost("map of maps", "m[i][\"a\"] = i; m[i][\"b\"] = i; m[i][\"c\"] = i;", "m", 100000);
+	foreachCost("range", "", "1000000", 1000000);
+}
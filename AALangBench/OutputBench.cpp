@@ -0,0 +1,39 @@
+#include <iostream>
+#include <string>
+#include <filesystem>
+#include "Bench.h"
+#include "AALang.h"
+
+// ns per print(value) into a file, with the given output buffer size
+static double printCost(const std::string& value, size_t bufferSize, const std::filesystem::path& path)
+{
+	const int count = 200000;
+
+	AALang aaLang;
+	aaLang.executeLine("i = 0;");
+	aaLang.output.setBufferSize(bufferSize);
+	aaLang.output.redirect(path.string());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	aaLang.executeLine("while({lt(i, " + std::to_string(count) + ");}, { print(" + value + "); i = add(i, 1); });");
+	aaLang.output.flush();
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / count;
+
+	aaLang.output.redirect("");
+	return ns;
+}
+
+void outputBench()
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "AALangBench.out";
+
+	std::cout << "print into a file (ns per call)" << std::endl;
+	std::cout << "value\tbuffered\tunbuffered" << std::endl;
+	for (const char* value : { "i", "mul(i, 0.5)", "\"a,csv,field\"" })
+	{
+		std::cout << value << "\t" << printCost(value, 64 * 1024, path) << "\t" << printCost(value, 0, path) << std::endl;
+	}
+
+	std::error_code ignored;
+	std::filesystem::remove(path, ignored);
+}
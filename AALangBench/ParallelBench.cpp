@@ -0,0 +1,62 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include "Bench.h"
+#include "AALang.h"
+#include "Interpreters.h"
+
+// ms for threads interpreters to each run a share of count loop iterations
+static double shardedCost(size_t threads, int count)
+{
+	const std::string loop = "while({lt(i, " + std::to_string(count / (int)threads) + ");}, { m[i] = i; i = add(i, 1); });";
+
+	auto start = std::chrono::high_resolution_clock::now();
+	runInterpreters(threads, [&](AALang& aaLang, size_t) {
+		aaLang.executeLine("i = 0;");
+		aaLang.executeLine("m = 0;");
+		aaLang.executeLine(loop);
+	});
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// ms for parallelFor over a numeric kernel on a pool of threads
+static double parallelForCost(size_t threads, int count)
+{
+	AALang aaLang;
+	aaLang.executeLine("parallelThreads(" + std::to_string(threads) + ");");
+	aaLang.executeLine("s = 0;");
+	const std::string kernel = "s = parallelFor(0, " + std::to_string(count) + ", { x = 0; j = 0; while({lt(j, 50);}, { x = add(x, mul(j, value())); j = add(j, 1); }); x; });";
+
+	// the first call starts the pool
+	aaLang.executeLine("parallelFor(0, 1, { 0; });");
+	auto start = std::chrono::high_resolution_clock::now();
+	aaLang.executeLine(kernel);
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void parallelBench()
+{
+	const int count = 4000000;
+	size_t cores = std::thread::hardware_concurrency();
+
+	std::cout << "one script sharded over interpreters (ms for " << count << " iterations)" << std::endl;
+	std::cout << "threads\tms\tspeedup" << std::endl;
+	double single = shardedCost(1, count);
+	std::cout << 1 << "\t" << single << "\t" << 1.0 << std::endl;
+	for (size_t threads = 2; threads <= cores && threads <= 16; threads *= 2)
+	{
+		double ms = shardedCost(threads, count);
+		std::cout << threads << "\t" << ms << "\t" << single / ms << std::endl;
+	}
+
+	const int items = 100000;
+	std::cout << "parallelFor, 50 multiply-adds per item (ms for " << items << " items)" << std::endl;
+	std::cout << "threads\tms\tspeedup" << std::endl;
+	single = parallelForCost(1, items);
+	std::cout << 1 << "\t" << single << "\t" << 1.0 << std::endl;
+	for (size_t threads = 2; threads <= cores && threads <= 16; threads *= 2)
+	{
+		double ms = parallelForCost(threads, items);
+		std::cout << threads << "\t" << ms << "\t" << single / ms << std::endl;
+	}
+}
@@ -0,0 +1,29 @@
+#include <iostream>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+
+// s = add(s, fragment) count times, then uses s as a map key, which needs
+// the text in one piece
+static void concatCost(int count, const std::string& fragment)
+{
+	AALang aaLang;
+	aaLang.executeLine("i = 0;");
+	aaLang.executeLine("m = 0;");
+	aaLang.executeLine("s = \"\";");
+
+	double build = elapsedMs(aaLang, "while({lt(i, " + std::to_string(count) + ");}, { s = add(s, \"" + fragment + "\"); i = add(i, 1); });");
+	double flatten = elapsedMs(aaLang, "m[s] = 1;");
+	std::cout << count << "\t" << fragment.size() << "\t" << build << "\t" << flatten << std::endl;
+}
+
+void stringBench()
+{
+	std::cout << "string concatenation (ms)" << std::endl;
+	std::cout << "fragments\tfragment size\tadd\tflatten" << std::endl;
+	for (int count : { 10000, 100000 })
+	{
+		concatCost(count, "fragment ");
+		concatCost(count, "a fragment long enough to never be copied on its own, 64 chars+");
+	}
+}
@@ -0,0 +1,196 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include "Bench.h"
+#include "AALang.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+// A workload is a script that sets ops and a block called bench. The script
+// itself is setup, bench() is timed a few times and the fastest run counts,
+// so it has to start over on every call. The script runs with the workload
+// directory as working directory, scratch names a file it may write.
+
+struct WorkloadResult
+{
+	std::string name;
+	bool ok = false;
+	double ops = 0;
+	double ms = 0;
+	double heapAllocations = 0;
+	double mallocs = 0;
+	size_t peakRssKb = 0;
+};
+
+static size_t peakRssKb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (size_t)usage.ru_maxrss;
+#endif
+}
+
+static WorkloadResult runWorkload(const std::filesystem::path& file, int repeat)
+{
+	WorkloadResult result;
+	result.name = file.stem().string();
+	std::filesystem::path scratch = std::filesystem::temp_directory_path() / ("AALangBench." + result.name + ".tmp");
+
+	{
+		AALang aaLang;
+#ifdef _WIN32
+		aaLang.output.redirect("NUL");
+#else
+		aaLang.output.redirect("/dev/null");
+#endif
+		aaLang.assignVariable("scratch", Variable(scratch.generic_string()));
+
+		Program program;
+		loadProgram(file.filename(), &program, &aaLang);
+		for (auto& line : program)
+			aaLang.executeLine(line);
+
+		Variable* ops = aaLang.findVariable("ops");
+		Variable* bench = aaLang.findVariable("bench");
+		if (ops && bench && bench->deref().type == Variable::VariableType::P_Block && ops->deref().number() > 0)
+		{
+			result.ok = true;
+			result.ops = ops->deref().number();
+			for (int i = 0; i < repeat; i++)
+			{
+				size_t heapAllocations = aaLang.heap.allocations;
+				size_t mallocs = allocationCount();
+				auto start = std::chrono::high_resolution_clock::now();
+				aaLang.callBlock("bench");
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+				if (i == 0 || ms < result.ms)
+				{
+					result.ms = ms;
+					result.heapAllocations = (double)(aaLang.heap.allocations - heapAllocations);
+					result.mallocs = (double)(allocationCount() - mallocs);
+				}
+			}
+		}
+	}
+
+	result.peakRssKb = peakRssKb();
+	std::error_code ignored;
+	std::filesystem::remove(scratch, ignored);
+	return result;
+}
+
+static std::string toJson(const WorkloadResult& result)
+{
+	std::ostringstream json;
+	json << "{\"name\": \"" << result.name << "\", \"ok\": " << (result.ok ? "true" : "false");
+	if (result.ok)
+	{
+		json << ", \"ops\": " << (int64_t)result.ops
+			<< ", \"ms\": " << result.ms
+			<< ", \"nsPerOp\": " << result.ms * 1e6 / result.ops
+			<< ", \"heapAllocationsPerOp\": " << result.heapAllocations / result.ops
+			<< ", \"mallocsPerOp\": " << result.mallocs / result.ops;
+	}
+	json << ", \"peakRssKb\": " << result.peakRssKb << "}";
+	return json.str();
+}
+
+// one workload in a child process where there is fork(), so the peak RSS
+// is that workload's alone
+static std::string isolatedWorkload(const std::filesystem::path& file, int repeat)
+{
+#ifdef _WIN32
+	return toJson(runWorkload(file, repeat));
+#else
+	int fds[2];
+	if (pipe(fds) != 0)
+		return toJson(runWorkload(file, repeat));
+
+	std::cout.flush();
+	std::cerr.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(fds[0]);
+		std::string json = toJson(runWorkload(file, repeat));
+		size_t written = 0;
+		while (written < json.size())
+		{
+			ssize_t n = write(fds[1], json.data() + written, json.size() - written);
+			if (n <= 0)
+				break;
+			written += (size_t)n;
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	std::string json;
+	char buffer[4096];
+	ssize_t n;
+	while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+		json.append(buffer, (size_t)n);
+	close(fds[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (json.empty())
+		json = "{\"name\": \"" + file.stem().string() + "\", \"ok\": false}";
+	return json;
+#endif
+}
+
+// runs every .aal in directory and writes the results to out as JSON
+int runSuite(const std::filesystem::path& directory, int repeat, std::ostream& out)
+{
+	std::vector<std::filesystem::path> files;
+	std::error_code error;
+	for (auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (entry.path().extension() == ".aal")
+			files.push_back(entry.path());
+	}
+	if (error || files.empty())
+	{
+		std::cerr << "No workloads found in " << directory << std::endl;
+		return 1;
+	}
+	std::sort(files.begin(), files.end());
+
+	std::filesystem::path previous = std::filesystem::current_path();
+	std::filesystem::current_path(directory);
+
+	int failed = 0;
+	out << "{\"repeat\": " << repeat << ", \"workloads\": [" << std::endl;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		std::cerr << "running " << files[i].filename().string() << std::endl;
+		std::string json = isolatedWorkload(files[i], repeat);
+		if (json.find("\"ok\": true") == std::string::npos)
+			failed++;
+		out << "  " << json << (i + 1 < files.size() ? "," : "") << std::endl;
+	}
+	out << "]}" << std::endl;
+
+	std::filesystem::current_path(previous);
+	return failed > 0 ? 1 : 0;
+}
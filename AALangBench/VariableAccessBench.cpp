@@ -0,0 +1,65 @@
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include "Bench.h"
+#include "AALang.h"
+
+static std::string globalName(int index)
+{
+	return "g" + std::to_string(index);
+}
+
+static double accessCost(int globalCount, bool treeWalk)
+{
+	const int accessesPerBlock = 100;
+	const size_t iterations = 10000;
+
+	AALang aaLang;
+	aaLang.treeWalk = treeWalk;
+	for (int i = 0; i < globalCount; ++i)
+	{
+		aaLang.assignVariable(globalName(i), Variable((int64_t)i));
+	}
+
+	std::string block;
+	std::string target = globalName(globalCount / 2);
+	for (int i = 0; i < accessesPerBlock; ++i)
+	{
+		block += target + ";";
+	}
+	int blockId = aaLang.blockCache.intern(block);
+	aaLang.executeBlock(blockId);
+
+	return measureNs(iterations, [&]() { aaLang.executeBlock(blockId); }) / accessesPerBlock;
+}
+
+// what every identifier read used to cost before globals moved to slots
+static double mapLookupCost(int globalCount)
+{
+	std::map<std::string, std::shared_ptr<Variable>> variables;
+	for (int i = 0; i < globalCount; ++i)
+	{
+		variables[globalName(i)] = std::make_shared<Variable>((int64_t)i);
+	}
+
+	std::string target = globalName(globalCount / 2);
+	std::shared_ptr<Variable> found;
+	double ns = measureNs(1000000, [&]() {
+		if (variables.find(target) != variables.end())
+			found = variables[target];
+	});
+
+	return found ? ns : 0;
+}
+
+void variableAccessBench()
+{
+	std::cout << "variable access (ns per read)" << std::endl;
+	std::cout << "globals\tbytecode\ttree-walk\tstd::map lookup" << std::endl;
+
+	for (int globalCount : { 10, 1000, 100000 })
+	{
+		std::cout << globalCount << "\t" << accessCost(globalCount, false) << "\t" << accessCost(globalCount, true) << "\t" << mapLookupCost(globalCount) << std::endl;
+	}
+}